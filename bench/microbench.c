@@ -0,0 +1,359 @@
+/* ===== microbench.c =====================================
+ * Microbenchmarks of the hot paths of the assembler, measured in isolation:
+ * - next_token over representative line shapes.
+ * - search_op & search_dir over the mnemonic set.
+ * - add_symbol & search_symbol at 10, 1k and 100k symbols.
+ * - encode_op_stm over operations of all types (R, I and J).
+ * - write_ob_file over large images.
+ * Each benchmark is repeated REPEATS times, and reported in ns per operation:
+ * the mean, the standard deviation and the minimum of the repetitions.
+ * Build & run with: make microbench && ./microbench
+ */
+
+/* ===== Includes ========================================= */
+#define _POSIX_C_SOURCE 199309L  /* clock_gettime */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "tokenizer.h"
+#include "parser.h"
+#include "scan.h"
+#include "output.h"
+#include "tables.h"
+#include "intern.h"
+#include "types.h"
+#include "consts.h"
+
+/* ===== CPP definitons =================================== */
+#define REPEATS     15        /* repetitions of each benchmark                 */
+#define LINE_ITERS  200000    /* iterations of a repetition, per benchmark     */
+#define TABLE_ITERS 1000000
+#define ENC_ITERS   2000000
+#define OB_DCF      (1L << 20)  /* size of the memory image written by write_ob_file */
+#define OB_PATH     "/tmp/microbench.as"  /* source path the .ob file is written next to */
+#define OB_OUT_PATH "/tmp/microbench.ob"
+#define ROW_FORMAT  "%-36s %10.2f %10.2f %10.2f\n"
+
+/* ===== Declarations ===================================== */
+/* the state of the assembler - defined in "assembler.c", which isn't linked in */
+char *filename, *filepath;
+long IC, DC, ICF, DCF;
+char *inst_img;
+char *mem_img;
+long mem_img_size;
+long options;
+int jobs = 1;
+char *cache_dir;
+
+/* a benchmark: runs iters operations of the benchmarked function */
+typedef void (*bench_fn)(long iters);
+
+/* representative line shapes */
+static const char *lines[] = {
+  "MAIN:  add $1, $2, $3",
+  "       addi $4, -120, $5",
+  "LOOP:  bne $1, $2, LOOP",
+  "       lw $1, 4, $2",
+  "       jmp $7",
+  "       call FUNC ; calling a function",
+  "STR:   .asciz \"hello, world\"",
+  "ARR:   .dw 1, -2, 3, 400000, 5, 6, 7, 8",
+  "       .entry MAIN",
+  "       stop"
+};
+#define LINES_CNT (sizeof(lines) / sizeof(*lines))
+
+/* the mnemonic set */
+static char *mnemonics[] = {
+  "add", "sub", "and", "or", "nor", "move", "mvhi", "mvlo", "addi", "subi",
+  "andi", "ori", "nori", "bne", "beq", "blt", "bgt", "lb", "sb", "lw", "sw",
+  "lh", "sh", "jmp", "la", "call", "stop", "foo"
+};
+#define MNEMONICS_CNT (sizeof(mnemonics) / sizeof(*mnemonics))
+
+static char *directives[] = {
+  "align", "asciz", "db", "dh", "dw", "entry", "extern", "fill", "incbin", "space", "bar"
+};
+#define DIRECTIVES_CNT (sizeof(directives) / sizeof(*directives))
+
+/* operations of all types, to be encoded */
+static const char *operations =
+  "add $1, $2, $3\n"
+  "move $4, $5\n"
+  "addi $4, -120, $5\n"
+  "bne $1, $2, LOOP\n"
+  "lw $1, 4, $2\n"
+  "jmp $7\n"
+  "la STR\n"
+  "stop\n";
+static Statement_t op_stms[16];
+static int op_stms_cnt;
+
+static int *symbols;  /* ids of the names of the symbols */
+static long symbols_cnt;
+
+/* ----- prototypes --------------------------------------- */
+char* get_output_path(const char *ext);
+int main(int argc, char **argv);
+
+static double now_ns();
+static void run(const char *name, bench_fn fn, long iters);
+static void bench_next_token(long iters);
+static void bench_search_op(long iters);
+static void bench_search_dir(long iters);
+static void fill_symtable(long count);
+static void bench_add_symbol(long iters);
+static void bench_search_symbol(long iters);
+static void parse_operations();
+static void bench_encode_op_stm(long iters);
+static void bench_write_ob_file(long iters);
+
+
+/* ===== Code ============================================= */
+
+/*
+ * Returns the path of the output file with extension ext, as "assembler.c" does.
+ * Required by write_ob_file.
+ */
+char*  /* the output path */
+get_output_path(const char *ext)
+{
+  const char *path = filepath, *dot = strrchr(path, '.');
+  char *newpath = malloc(strlen(path) + strlen(ext) + 1);
+  memcpy(newpath, path, dot - path);
+  strcpy(&newpath[dot - path], ext);
+  return newpath;
+}
+
+
+/*
+ * Returns the time of a monotonic clock, in nanoseconds.
+ */
+static double  /* the time */
+now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+/*
+ * Runs a benchmark REPEATS times (after a warm-up run) and prints its row:
+ * the mean, standard deviation and minimum of the ns per operation.
+ */
+static void
+run(const char *name, bench_fn fn, long iters)
+{
+  double samples[REPEATS], start, mean = 0, var = 0, min;
+  int i;
+  fn(iters);  /* warm up */
+  for(i=0; i<REPEATS; i++) {
+    start = now_ns();
+    fn(iters);
+    samples[i] = (now_ns() - start) / iters;
+    mean += samples[i] / REPEATS;
+  }
+  min = samples[0];
+  for(i=0; i<REPEATS; i++) {
+    var += (samples[i] - mean) * (samples[i] - mean) / REPEATS;
+    if(samples[i] < min)
+      min = samples[i];
+  }
+  printf(ROW_FORMAT, name, mean, sqrt(var), min);
+  fflush(stdout);
+}
+
+
+/*
+ * Tokenizes whole lines, cycling through the line shapes.
+ * An operation is tokenizing one line (including copying it, as next_token modifies it).
+ */
+static void
+bench_next_token(long iters)
+{
+  char line[MAX_LINE_LEN + 2];
+  Token_t tok;
+  long i;
+  for(i=0; i<iters; i++) {
+    strcpy(line, lines[i % LINES_CNT]);
+    for(tok = next_token(line); tok.type != TOK_END; tok = next_token(NULL)) {
+      if(tok.type == TOK_STRING)
+        free(tok.value.str);
+      if(tok.type == TOK_ERR)
+        break;
+    }
+  }
+}
+
+
+/*
+ * Searches the operation table, cycling through the mnemonics.
+ */
+static void
+bench_search_op(long iters)
+{
+  long i;
+  for(i=0; i<iters; i++)
+    search_op(mnemonics[i % MNEMONICS_CNT]);
+}
+
+
+/*
+ * Searches the directive table, cycling through the directive names.
+ */
+static void
+bench_search_dir(long iters)
+{
+  long i;
+  for(i=0; i<iters; i++)
+    search_dir(directives[i % DIRECTIVES_CNT]);
+}
+
+
+/*
+ * Interns the names of count symbols, to be added to the symbol table.
+ */
+static void
+fill_symtable(long count)
+{
+  char name[MAX_LABEL_LEN + 1];
+  long i;
+  cleanup_interner();
+  init_interner();
+  free(symbols);
+  symbols = malloc(count * sizeof(int));
+  for(i=0; i<count; i++) {
+    sprintf(name, "sym%ld", i);
+    symbols[i] = intern(name, strlen(name));
+  }
+  symbols_cnt = count;
+}
+
+
+/*
+ * Builds a symbol table of all the interned symbols, iters/symbols_cnt times.
+ * An operation is adding one symbol.
+ */
+static void
+bench_add_symbol(long iters)
+{
+  SymbolEntry_t symbol;
+  long i;
+  symbol.attr = SYM_CODE;
+  for(i=0; i<iters; i++) {
+    if(i % symbols_cnt == 0) {
+      cleanup_symtable();
+      init_symtable();
+    }
+    symbol.name = symbols[i % symbols_cnt];
+    symbol.offset = i;
+    add_symbol(symbol);
+  }
+}
+
+
+/*
+ * Searches the symbol table (built by bench_add_symbol) for pseudo-random symbols.
+ */
+static void
+bench_search_symbol(long iters)
+{
+  unsigned long seed = 1;
+  long i;
+  for(i=0; i<iters; i++) {
+    seed = seed * 1103515245UL + 12345UL;
+    search_symbol(symbols[(seed >> 8) % symbols_cnt]);
+  }
+}
+
+
+/*
+ * Parses the benchmarked operations into op_stms.
+ */
+static void
+parse_operations()
+{
+  FILE *file = tmpfile();
+  fputs(operations, file);
+  rewind(file);
+  for(op_stms_cnt = 0; parse_next_statement(file, &op_stms[op_stms_cnt], op_stms_cnt+1, 1);)
+    op_stms_cnt++;
+  fclose(file);
+}
+
+
+/*
+ * Encodes operations, cycling through the operation types.
+ */
+static void
+bench_encode_op_stm(long iters)
+{
+  volatile int32_t enc;
+  long i;
+  for(i=0; i<iters; i++)
+    enc = encode_op_stm(op_stms[i % op_stms_cnt].inst.op_inst);
+  (void)enc;
+}
+
+
+/*
+ * Writes the .ob file of a full instruction image and a large memory image.
+ * An operation is writing one byte of the images.
+ */
+static void
+bench_write_ob_file(long iters)
+{
+  long i;
+  for(i=0; i<iters; i += ICF + DCF)
+    write_ob_file();
+}
+
+
+/*
+ * Main.
+ * Runs all the benchmarks and prints a row for each.
+ */
+int
+main(int argc, char **argv)
+{
+  long i, counts[] = {10, 1000, 100000};
+  char name[64];
+  filepath = filename = OB_PATH;
+  init_interner();
+  init_symtable();
+
+  printf("%-36s %10s %10s %10s\n", "benchmark (ns/op)", "mean", "stddev", "min");
+  run("next_token (whole line)", bench_next_token, LINE_ITERS);
+  run("search_op", bench_search_op, TABLE_ITERS);
+  run("search_dir", bench_search_dir, TABLE_ITERS);
+  for(i=0; i<3; i++) {
+    fill_symtable(counts[i]);
+    sprintf(name, "add_symbol (%ld symbols)", counts[i]);
+    run(name, bench_add_symbol, counts[i] < TABLE_ITERS ? TABLE_ITERS : counts[i]);
+    sprintf(name, "search_symbol (%ld symbols)", counts[i]);
+    run(name, bench_search_symbol, TABLE_ITERS);
+  }
+  parse_operations();
+  run("encode_op_stm (R, I, J types)", bench_encode_op_stm, ENC_ITERS);
+
+  ICF = MAX_PROG_LINES * 4;
+  DCF = OB_DCF;
+  inst_img = malloc(ICF);
+  mem_img = malloc(DCF);
+  for(i=0; i<ICF; i++)
+    inst_img[i] = i * 7;
+  for(i=0; i<DCF; i++)
+    mem_img[i] = i * 13;
+  run("write_ob_file (per byte)", bench_write_ob_file, ICF + DCF);
+  remove(OB_OUT_PATH);
+
+  cleanup_symtable();
+  cleanup_interner();
+  free(symbols);
+  free(inst_img);
+  free(mem_img);
+  return 0;
+}
@@ -0,0 +1,34 @@
+; ===== data_prog.as ======================================
+; this file contains valid assembly code using the data
+; layout directives: .align, .space, .fill and .incbin.
+
+; ===== Code ==============================================
+        .entry  TABLE
+        .extern OUT
+MAIN:   la      BYTES
+        la      TABLE
+        la      ZEROS
+        la      HEAD
+        call    OUT
+        stop
+
+; ===== Data ==============================================
+; .align pads to the next multiple of its argument.
+BYTES:  .db     1, 2, 3
+        .align  4
+TABLE:  .dw     -1, 2147483647
+        .dh     7
+        .align  8
+; .fill writes count chunks of 1, 2 or 4 bytes.
+        .fill   3, 1, -1
+        .fill   2, 2, -2
+        .fill   2, 4, 305419896
+; a long zero .space (or .fill) is kept as a run of zeros.
+ZEROS:  .space  70
+        .fill   20, 4, 0
+        .space  3
+; .incbin includes a file - here, the head of this one.
+HEAD:   .incbin "data_prog.as", 2, 24
+        .align  2
+        .incbin "data_prog.as", 0, 1
+        .asciz  "end"
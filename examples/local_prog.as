@@ -0,0 +1,43 @@
+; ===== local_prog.as =====================================
+; this file contains valid assembly code using local labels.
+; - every definition of a local label is a label of its own,
+;   referenced backward ("1b") or forward ("1f") from its uses.
+
+; ===== Loops =============================================
+; the same local label is defined again and again, as in
+; generated code - each reference resolves to the nearest one.
+
+        .entry  MAIN
+        .extern PRINT
+MAIN:   addi    $1, 3, $1
+1:      subi    $1, 1, $1
+        bne     $1, $0, 1b
+        addi    $2, 4, $2
+1:      subi    $2, 1, $2
+        beq     $2, $0, 1f
+        call    PRINT
+        jmp     1b
+1:      addi    $3, 2, $3
+1:      bne     $3, $0, 1f
+        subi    $3, 1, $3
+        jmp     1b
+1:      stop
+
+; ===== Nested ============================================
+; different numbers don't interfere, and a label is
+; referenced from its own line.
+
+OUTER:  addi    $4, 2, $4
+2:      addi    $5, 2, $5
+1:      subi    $5, 1, $5
+        bne     $5, $0, 1b
+        subi    $4, 1, $4
+        bne     $4, $0, 2b
+9999:   bgt     $4, $5, 9999b
+        jmp     9999f
+9999:   la      STR
+        jmp     OUTER
+
+; ===== Data ==============================================
+1:      .dh     1, 2, 3
+STR:    .asciz  "local"
@@ -0,0 +1,88 @@
+; ===== macro_prog.as =====================================
+; this file contains valid assembly code using macros,
+; local labels and the li pseudo-operation.
+; - the padding in between pushes a branch out of the range
+;   of its 16-bit offset, so that it is relaxed.
+
+; ===== Macros ============================================
+; a loop counting a register down, from a value loaded by li.
+.macro  count   r, n
+        li      \r, \n
+1:      subi    \r, 1, \r
+        bne     \r, $0, 1b
+.endm
+
+; 16 hard constants, each loaded by a long li sequence.
+.macro  pad     r
+        li      \r, 305419896
+        li      \r, 2147483647
+        li      \r, -2147483648
+        li      \r, 123456789
+        li      \r, 987654321
+        li      \r, -123456789
+        li      \r, 1431655765
+        li      \r, -1431655766
+        li      \r, 19088743
+        li      \r, 268435455
+        li      \r, 1073741823
+        li      \r, -1073741825
+        li      \r, 858993459
+        li      \r, 2004318071
+        li      \r, 1717986918
+        li      \r, 1234567890
+.endm
+
+; ===== Code ==============================================
+        .entry  MAIN
+        .extern FAR
+MAIN:   count   $1, 10
+LOOP:   count   $2, 65536
+        count   $3, 32768
+        li      $4, -1
+        li      $5, -32769
+; too far ahead - relaxed, and in range
+        bne     $1, $2, END
+        beq     $1, $2, 1f
+1:      call    FAR
+
+; ===== Padding ===========================================
+        pad     $6
+        pad     $7
+        pad     $8
+        pad     $9
+        pad     $10
+        pad     $11
+        pad     $12
+        pad     $13
+        pad     $14
+        pad     $15
+        pad     $16
+        pad     $17
+        pad     $18
+        pad     $19
+        pad     $20
+        pad     $21
+        pad     $22
+        pad     $23
+        pad     $24
+        pad     $25
+        pad     $6
+        pad     $7
+        pad     $8
+        pad     $9
+        pad     $10
+        pad     $11
+        pad     $12
+        pad     $13
+        pad     $14
+        pad     $15
+        pad     $16
+        pad     $17
+        pad     $18
+        pad     $19
+
+; too far back - relaxed
+END:    bgt     $1, $2, LOOP
+        la      STR
+        stop
+STR:    .asciz  "macros"
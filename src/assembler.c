@@ -1,8 +1,15 @@
 /* ===== assembler.c ======================================
  * The main source file of the assembler.
- * - Handles cmdline parameter parsing (opening files).
+ * - Handles cmdline parameter parsing (options & opening files).
  * - Defines the instruction and memory images & assembles them by calling "scan.c".
- * - Creates and writes the '.ob', '.ent', '.ext' files.
+ * - Creates and writes the '.ob', '.ent', '.ext' files (see "output.c"),
+ *   or streams them to stdout. With --format, the object file is written as a flat
+ *   binary ('.bin') or as Intel HEX ('.hex') instead.
+ * - Reads the paths of the source files from list files (@listfile, --files-from),
+ *   in which every entry may name its own output directory.
+ * - Runs the language server instead of assembling, with --lsp (see "lsp.c").
+ * - Loads parsed source files from the cache instead of parsing them, with --cache
+ *   (see "cache.c").
  */
 
 /* ===== Includes ========================================= */
@@ -14,38 +21,136 @@
 #include <string.h>
 #include "parser.h"
 #include "scan.h"
+#include "optimize.h"
+#include "estimate.h"
+#include "output.h"
 #include "tables.h"
+#include "intern.h"
+#include "errors.h"
+#include "lsp.h"
+#include "relax.h"
+#include "cache.h"
 #include "consts.h"
 
 
 /* ===== CPP definitons =================================== */
-#define HELP_TEXT   "usage: %s file1 [file2] [file3] ..."
+#define HELP_TEXT   "usage: %s [options] file1 [file2] [file3] ..."
 #define NOARGS_ERR  "missing argument"
 #define EXT_ERR     "%s: %s: source file extension must be .as"
+#define OPT_ERR     "unrecognized option '%s'"
+#define DCE_NOTE    "removed %d bytes of unreachable instructions"
+#define COST_ERR    "%s:%d: invalid cost model line"
+#define STDOUT_ERR  "invalid value '%s' for --stdout, expected 'all'"
+#define FORMAT_ERR  "invalid value '%s' for --format, expected 'ob', 'bin' or 'hex'"
+#define BIN_STDOUT_ERR "--format=bin can't be combined with --stdout=all"
+#define JOBS_ERR    "invalid value '%s' for --jobs, expected a number between 1 and %d"
+#define LOWMEM_ERR  "--low-memory can't be combined with -O, --thread-jumps, --dce, "\
+                    "--merge-data or --estimate"
+#define LOWMEM_NOTE "source can't be re-read, assembling without --low-memory"
+#define STDIN_PATH  "-"        /* source path denoting stdin */
+#define STDIN_NAME  "<stdin>"  /* file name of stdin in error messages */
+#define LIST_PREFIX '@'        /* prefix of a list file argument */
+#define LIST_LINE_SIZE 4096    /* maximal length of an entry in a list file */
+#define LIST_COMMENT '#'       /* prefix of a comment line in a list file */
+#define STATUS_LINE "%s: %s\n"              /* format of a --status line */
+#define SUMMARY_LINE "%d files, %d failed\n" /* format of the --status summary */
+#define OPTIONS_CNT (sizeof(options_table) / sizeof(*options_table))
+/* options that don't affect diagnostics, and are ignored by --check */
+#define CHECK_IGNORED (OPT_PEEPHOLE | OPT_THREAD | OPT_DCE | OPT_MERGE_DATA | OPT_ESTIMATE\
+                       | OPT_IF_CHANGED)
+/* options that require the whole array of statements, see --low-memory */
+#define LOWMEM_CONFLICTS (OPT_PEEPHOLE | OPT_THREAD | OPT_DCE | OPT_MERGE_DATA | OPT_ESTIMATE)
 
 /* ===== Declarations ===================================== */
 char *filename, *filepath;
 long IC, DC, ICF, DCF;
-char inst_img[MAX_PROG_LINES * 4];  /* instruction image - 4 bytes per instruction */
-char mem_img[MAX_PROG_MEMORY];
+char *inst_img;     /* instruction image - 4 bytes per instruction, allocated once ICF is known */
+char *mem_img;      /* memory image - grows as data is written (see "scan.c") */
+long mem_img_size;  /* allocated size of the memory image */
+long options;  /* bitwise-OR of the OPT_* flags defined in "consts.h" */
+char *cost_model;  /* value of the --cost-model option */
+char *stdout_mode; /* value of the --stdout option */
+char *jobs_value;  /* value of the --jobs option */
+char *files_from;  /* value of the --files-from option */
+char *cache_dir;   /* value of the --cache option */
+char *format_value; /* value of the --format option */
+char *outdir;      /* directory of the outputs of the current file, NULL for next to it */
+static int files_cnt, failed_cnt;  /* counts of the assembled files, for --status */
+static char *progname;  /* argv[0], for error messages */
+int jobs = 1;      /* count of threads encoding instructions, see "scan.c" */
 
 /* defined in tables.c */
 extern SymbolEntry_t *symtable ;
 extern int symtable_size;  
-extern int error_occurred;  /* defined in "errors.c" */
+/* defined in "errors.c" */
+extern int error_occurred;
+extern FILE *msgout;
 
 /* ----- prototypes --------------------------------------- */
+int parse_option(char *arg);
 const char* get_file_ext(const char *path);
 char* modify_file_ext(const char *path, const char *ext);
-char get_img_byte(int n);
-void write_ob_file();
-void write_ext_file();
-void write_ent_file();
+char* get_output_path(const char *ext);
 int assemble(FILE *source);
+int assemble_path(char *path);
+int assemble_list(FILE *list);
 int main(int argc, char** argv);
 
+static void report_status(const char *path, int status);
+
+/* ===== Options table ==================================== */
+struct option {
+  char *name;
+  long flag;
+  char **value;  /* for options of the form name=value: where the value is stored */
+} options_table[] = {
+  {"-O",              OPT_PEEPHOLE,   NULL},
+  {"--thread-jumps",  OPT_THREAD,     NULL},
+  {"--dce",           OPT_DCE,        NULL},
+  {"--merge-data",    OPT_MERGE_DATA, NULL},
+  {"--align-data",    OPT_ALIGN_DATA, NULL},
+  {"--estimate",      OPT_ESTIMATE,   NULL},
+  {"--cost-model",    OPT_ESTIMATE,   &cost_model},
+  {"--stdout",        OPT_STDOUT,     NULL},
+  {"--stdout",        OPT_STDOUT,     &stdout_mode},
+  {"--low-memory",    OPT_LOW_MEMORY, NULL},
+  {"--jobs",          OPT_JOBS,       &jobs_value},
+  {"--status",        OPT_STATUS,     NULL},
+  {"--if-changed",    OPT_IF_CHANGED, NULL},
+  {"--check",         OPT_CHECK,      NULL},
+  {"--lsp",           OPT_LSP,        NULL},
+  {"--cache",         OPT_CACHE,      &cache_dir},
+  {"--format",        0,              &format_value},
+  {"--files-from",    0,              &files_from}
+};
+
 /* ===== Code ============================================= */
 
+/*
+ * Parses a cmdline option and sets the corresponding flag in options.
+ * For options of the form name=value, the value is stored as well.
+ * Returns -1 if arg isn't a recognized option, else 0.
+ */
+int  /* nonzero on failure */
+parse_option(char *arg)
+{
+  int i, len;
+  for(i=0; i<OPTIONS_CNT; i++) {
+    len = strlen(options_table[i].name);
+    if(options_table[i].value == NULL && 0 == strcmp(arg, options_table[i].name)) {
+      options |= options_table[i].flag;
+      return 0;
+    }
+    if(options_table[i].value != NULL && 0 == strncmp(arg, options_table[i].name, len)
+      && arg[len] == '=') {
+      options |= options_table[i].flag;
+      *options_table[i].value = &arg[len+1];
+      return 0;
+    }
+  }
+  return -1;
+}
+
 /*  
  * Returns the file extension of the file pointed to by path.
  * e.g: get_file_ext("/tmp/prog.as") -> ".as"
@@ -77,127 +182,192 @@ modify_file_ext(const char *path, const char *ext)
 }
 
 /*
- * Returns the nth byte in the combined image of instructions and memory.
- */
-char  /* the byte */
-get_img_byte(int n) {
-  if(n < ICF) {
-    return inst_img[n];
-  }
-  return mem_img[n-ICF];
-}
-
-/*
- * Writes the .ob file according to the langauage specifications.
+ * Returns the path of the output file of the current source file with extension ext:
+ * next to the source file, or in outdir if it's set.
+ * e.g: with outdir "out", get_output_path(".ob") of "/tmp/prog.as" -> "out/prog.ob"
+ * The returned path should be freed by the caller.
  */
-void
-write_ob_file()
+char*  /* the output path */
+get_output_path(const char *ext)
 {
-  char *obfilename = modify_file_ext(filepath, ".ob");
-  FILE *obfile = fopen(obfilename, "w");
-  int i;
-  free(obfilename);  /* was only required to open file */
-
-  /* header line */
-  fprintf(obfile, "     %lu %lu\n%04d ", ICF, DCF, INITIAL_IC);
-  /* bytes */
-  for(i=0; i < DCF + ICF - 1; i++) {
-    fprintf(obfile, "%02X", get_img_byte(i) & 0xFF);
-    if(i % 4 == 3) /* 4th and last byte in line */
-      fprintf(obfile, "\n%04d ", i+INITIAL_IC+1);
-    else fprintf(obfile, " ");
-  }
-  fprintf(obfile, "%02X\n", get_img_byte(ICF+DCF-1) & 0xFF);
-  if(obfile) fclose(obfile);
-}
-
-
-/*
- * If applicable, Writes the .ext file according to the langauage specifications.
- */
-void
-write_ext_file()
-{
-  char *extfilename = modify_file_ext(filepath, ".ext");
-  FILE *extfile = NULL;
-  SymbolEntry_t symbol;
-  int i;
-  for(i=0; i<symtable_size; i++) {
-    symbol = symtable[i];
-    if((symbol.attr & SYM_REQUIRED) && (symbol.attr & SYM_EXTERN)) {
-      if(extfile == NULL) /* only create file if relevant */ {
-        extfile = fopen(extfilename, "w");
-        free(extfilename);  /* was only required to open file */
-      }
-      fprintf(extfile, "%s %04ld\n", symbol.name,
-          symbol.offset + INITIAL_IC + (symbol.attr & SYM_DATA ? ICF : 0)
-      );
-    }
-  }
-  if(extfile) fclose(extfile);
-}
-
-/*
- * If applicable, Writes the .ent file according to the langauage specifications.
- */
-void
-write_ent_file()
-{
-  char *entfilename = modify_file_ext(filepath, ".ent");
-  FILE *entfile = NULL;
-  SymbolEntry_t symbol;
-  int i;
-  for(i=0; i<symtable_size; i++) {
-    symbol = symtable[i];
-    if((symbol.attr & SYM_ENTRY) && !(symbol.attr & SYM_REQUIRED)) {
-      if(entfile == NULL) /* only create file if relevant */ {
-        entfile = fopen(entfilename, "w");
-        free(entfilename);  /* was only required to open file */
-      }
-      fprintf(entfile, "%s %04ld\n", symbol.name,
-          symbol.offset + INITIAL_IC + (symbol.attr & SYM_DATA ? ICF : 0)
-      );
-    }
-  }
-  if(entfile) fclose(entfile);
+  char *path;
+  long len;
+  if(outdir == NULL)
+    return modify_file_ext(filepath, ext);
+  len = get_file_ext(filename) - filename;
+  path = malloc(strlen(outdir) + 1 + len + strlen(ext) + 1);
+  sprintf(path, "%s/%.*s%s", outdir, (int)len, filename, ext);
+  return path;
 }
 
 /* 
  * Assembles source file.
  * If the source code is valid:
- *    Writes .ob and .ext, .ent files if relevant.
+ *    Writes .ob and .ext, .ent files if relevant (or streams them to stdout).
  * Else:
  *  Prints all syntax errors in file, writes none files and returns 1.
+ * With --check, the images aren't built and no output is written,
+ * only the diagnostics are printed.
+ * With --cache, the statements are loaded from the cache if the file is unchanged,
+ * and stored in it after parsing otherwise (see "cache.c").
  */
 int  /* nonzero on failure */
 assemble(FILE *source)
 {
   /* init */
-  Statement_t *statements;
+  Statement_t *statements = NULL;
+  char *cache_path = NULL;
+  int saved, streamed;
   error_occurred = 0;
-  statements = parse_file(source);
+  init_interner();  /* label names are interned per assembled file */
+  /* streaming requires re-reading the source, which pipes don't allow */
+  streamed = (options & OPT_LOW_MEMORY) && 0 == fseek(source, 0L, SEEK_CUR);
+  if((options & OPT_LOW_MEMORY) && !streamed)
+    print_note(LOWMEM_NOTE);
+  if(!streamed) {
+    if((options & OPT_CACHE) && NULL != (cache_path = get_cache_path(source)))
+      statements = load_cache(cache_path);
+    if(statements == NULL) {  /* not cached */
+      statements = parse_file(source);
+      if(cache_path != NULL && !error_occurred)
+        store_cache(cache_path, statements);
+    }
+    free(cache_path);
+    if(!error_occurred) {  /* optional optimization passes */
+      if(options & OPT_THREAD)
+        thread_jumps(statements);
+      if((options & OPT_DCE) && 0 != (saved = eliminate_dead_code(statements)))
+        print_note(DCE_NOTE, saved);
+      if(options & OPT_PEEPHOLE)
+        peephole_optimize(statements);
+    }
+    statements = relax_branches(statements);  /* far branches, see "relax.c" */
+    if(!error_occurred && (options & OPT_ESTIMATE))  /* at the final addresses */
+      estimate_cycles(statements);
+  }
   IC = 0; DC = 0;
-  memset(inst_img, 0, sizeof(inst_img));
-  memset(mem_img, 0, sizeof(mem_img));
+  free(mem_img);
+  free(inst_img);
+  mem_img = inst_img = NULL;
+  if(!(options & OPT_CHECK)) {  /* --check never writes the images */
+    mem_img_size = MAX_PROG_MEMORY;
+    mem_img = calloc(mem_img_size, sizeof(char));
+  }
   init_symtable();
 
-  write_memory_image(statements);
-  ICF = IC; DCF = DC;
-  IC = 0; DC = 0;
-  write_instruction_image(statements);
-  free(statements);
+  if(streamed)
+    write_images_streamed(source);
+  else {
+    write_memory_image(statements);
+    ICF = IC; DCF = DC;
+    IC = 0; DC = 0;
+    if(!(options & OPT_CHECK))
+      inst_img = calloc(ICF + 1, sizeof(char));
+    write_instruction_image(statements);
+    free(statements);
+  }
   /* can be set by any of the above calls */
   if(error_occurred) return 1;
+  if(options & OPT_CHECK) return 0;
 
 
+  if(options & OPT_STDOUT) {
+    write_stream(stdout, stdout_mode != NULL);
+    return 0;
+  }
   write_ob_file();
   write_ext_file();
   write_ent_file();
   return 0;
 }
 
+/*
+ * With --status, prints the status line of an assembled source file:
+ * status is 0 if it was assembled, 1 if it failed to assemble,
+ * or -1 if it was skipped (it couldn't be opened, or isn't a .as file).
+ */
+static void
+report_status(const char *path, int status)
+{
+  files_cnt++;
+  if(status != 0)
+    failed_cnt++;
+  if(options & OPT_STATUS)
+    fprintf(msgout, STATUS_LINE, path, status == 0 ? "ok" : status == 1 ? "failed" : "skipped");
+}
+
+/*
+ * Assembles the source file at path ("-" for stdin), writing its outputs.
+ * Returns 0 if it was assembled, 1 if it failed to assemble,
+ * or -1 if it was skipped (it couldn't be opened, or isn't a .as file).
+ */
+int  /* nonzero on failure */
+assemble_path(char *path)
+{
+  FILE *file;
+  int status;
+  if(0 == strcmp(path, STDIN_PATH)) {
+    filepath = filename = STDIN_NAME;
+    status = assemble(stdin);
+    cleanup_symtable();
+    cleanup_interner();
+    report_status(STDIN_NAME, status);
+    return status;
+  }
+
+  filepath = path;
+  filename = basename(filepath);
+  if (NULL == (file = fopen(filepath, "r"))) {
+    /* file won't open - print error message and skip it */
+    error(0, errno, "%s", path);
+    report_status(path, -1);
+    return -1;
+  }
+  if(0 != strcmp(".as", get_file_ext(filename))) {
+    fclose(file);
+    fprintf(msgout, EXT_ERR"\n", progname, filepath);
+    report_status(path, -1);
+    return -1;
+  }
+  status = assemble(file);
+  fclose(file);
+  cleanup_symtable();
+  cleanup_interner();
+  report_status(path, status);
+  return status;
+}
+
+/*
+ * Assembles the source files listed in list, one entry per line:
+ *    <source path> [<output directory>]
+ * The outputs of a file are written into its output directory if one is given,
+ * else next to the file. Empty lines and lines starting with '#' are ignored.
+ * The list is streamed, so it may be arbitrarily long.
+ * Returns 1 if atleast 1 listed file failed to assemble, else 0.
+ */
+int  /* nonzero on failure */
+assemble_list(FILE *list)
+{
+  char line[LIST_LINE_SIZE], *path;
+  int exit_status = 0;
+  while(NULL != fgets(line, LIST_LINE_SIZE, list)) {
+    path = strtok(line, WSPACE_CHARS);
+    if(path == NULL || path[0] == LIST_COMMENT)
+      continue;
+    outdir = strtok(NULL, WSPACE_CHARS);
+    if(assemble_path(path) == 1)
+      exit_status = 1;
+  }
+  outdir = NULL;
+  return exit_status;
+}
+
 /*
  * Main.
+ * Options (arguments starting with '-') apply to all files, regardless of their position.
+ * A "-" argument reads the source from stdin, and implies --stdout.
+ * A "@listfile" argument assembles the files listed in listfile (see assemble_list),
+ * and so does --files-from=listfile, after all other arguments ("-" for stdin).
  * Exit code is 0 if all files successfuly were successfuly assembled.
  * If atleast 1 file failed to assemble, the exit code is 1.
  */
@@ -205,9 +375,9 @@ int  /* nonzero on failure */
 main(int argc, char** argv)
 {
 
-  int exit_status;
+  int exit_status, ret;
   size_t i;
-  FILE *file;
+  FILE *list;
 
   /*int n = 1;
   printf("integer: %ld\n", -1 * (1L << ((n)-1)));
@@ -216,29 +386,76 @@ main(int argc, char** argv)
   printf("integer: %ld\n", (1L << ((n)-1)));
   printf("integer: %d\n", ~(~0 << ((n)-1)));*/
 
+  progname = argv[0];
   if (argc < 2)  /* no cmdline arguments - print error and exit */
     error(EXIT_FAILURE, 0, NOARGS_ERR"\n"HELP_TEXT, argv[0]);
 
-  exit_status = 0;  /* =0 iff all files successfuly assembled, else 1 */
   for (i=1; i<argc; i++) {
+    if(0 == strcmp(argv[i], STDIN_PATH))
+      options |= OPT_STDOUT;
+    else if(argv[i][0] == '-' && 0 != parse_option(argv[i]))
+      error(EXIT_FAILURE, 0, OPT_ERR"\n"HELP_TEXT, argv[i], argv[0]);
+  }
+  if(stdout_mode != NULL && 0 != strcmp(stdout_mode, "all"))
+    error(EXIT_FAILURE, 0, STDOUT_ERR, stdout_mode);
+  if(format_value != NULL && 0 != set_ob_format(format_value))
+    error(EXIT_FAILURE, 0, FORMAT_ERR, format_value);
+  /* the framed stream is line-based */
+  if(stdout_mode != NULL && format_value != NULL && 0 == strcmp(format_value, "bin"))
+    error(EXIT_FAILURE, 0, BIN_STDOUT_ERR);
+  if(jobs_value != NULL) {
+    jobs = atoi(jobs_value);
+    if(jobs < 1 || jobs > MAX_JOBS || strspn(jobs_value, "0123456789") != strlen(jobs_value))
+      error(EXIT_FAILURE, 0, JOBS_ERR, jobs_value, MAX_JOBS);
+  }
+  if(options & OPT_CHECK)
+    options &= ~CHECK_IGNORED;
+  if((options & OPT_LOW_MEMORY) && (options & LOWMEM_CONFLICTS))
+    error(EXIT_FAILURE, 0, LOWMEM_ERR);
+  /* keep stdout clean for the streamed outputs */
+  msgout = (options & OPT_STDOUT) ? stderr : stdout;
+  if(options & OPT_LSP) {  /* stdout carries the protocol */
+    msgout = stderr;
+    return run_lsp(stdin, stdout);
+  }
+  if(cost_model != NULL && 0 != (ret = load_cost_model(cost_model))) {
+    if(ret == -1)
+      error(EXIT_FAILURE, errno, "%s", cost_model);
+    error(EXIT_FAILURE, 0, COST_ERR, cost_model, ret);
+  }
 
-    filepath = argv[i];
-    filename = basename(filepath);
-    if (NULL == (file = fopen(filepath, "r")))
-      /* file won't open - print error message and skip it */
-      error(0, errno, "%s", argv[i]);
-    else {
-      if(0 != strcmp(".as", get_file_ext(filename))) {
-        fclose(file);
-        printf(EXT_ERR"\n", argv[0], filepath);
+  exit_status = 0;  /* =0 iff all files successfuly assembled, else 1 */
+  for (i=1; i<argc; i++) {
+    if(argv[i][0] == LIST_PREFIX) {
+      if(NULL == (list = fopen(&argv[i][1], "r"))) {
+        error(0, errno, "%s", &argv[i][1]);
+        exit_status = 1;
         continue;
       }
-      if(assemble(file) != 0)
+      if(assemble_list(list) != 0)
         exit_status = 1;
+      fclose(list);
+      continue;
+    }
+    if(argv[i][0] == '-' && 0 != strcmp(argv[i], STDIN_PATH))
+      continue;  /* option - already parsed */
+    if(assemble_path(argv[i]) == 1)
+      exit_status = 1;
+  }
+  if(files_from != NULL) {
+    list = 0 == strcmp(files_from, STDIN_PATH) ? stdin : fopen(files_from, "r");
+    if(list == NULL) {
+      error(0, errno, "%s", files_from);
+      exit_status = 1;
+    } else {
+      if(assemble_list(list) != 0)
+        exit_status = 1;
+      if(list != stdin)
+        fclose(list);
     }
-    if(file) fclose(file);
-    cleanup_symtable();
   }
+  if(options & OPT_STATUS)
+    fprintf(msgout, SUMMARY_LINE, files_cnt, failed_cnt);
 
   return exit_status;
 }
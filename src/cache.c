@@ -0,0 +1,352 @@
+/* ===== cache.c ==========================================
+ * This module is responsible for the cache of parsed source files (--cache=DIR):
+ * the array of statements parsed from a file (see "parser.c") is stored in a
+ * compact binary blob, named after a hash of the contents of the file. Assembling
+ * an unchanged file again maps its blob and rebuilds the array from it, skipping
+ * the tokenizer and the parser altogether.
+ *
+ * The statements are stored after macros and li are expanded, and before any of the
+ * optional passes, so a blob doesn't depend on the options a file is assembled with.
+ * Only files that parsed without errors are stored. A blob is only valid for the build
+ * that wrote it (the statements are stored as they're laid out in memory), so its header
+ * holds CACHE_VERSION and a fingerprint of the layout (see layout_fingerprint), and a
+ * blob of another build is ignored (and replaced).
+ *
+ * Blob layout:
+ *  header      - struct cache_header.
+ *  names       - the interned label names (in order of their ids), null-terminated.
+ *  statements  - the statements, without their pointers. Label ids are those of the
+ *                names, and are mapped to the ids they're interned with when loading.
+ *  payloads    - the arrays & strings the statements point to, in order of statements.
+ */
+
+/* ===== Includes ========================================= */
+#define _POSIX_C_SOURCE 200809L  /* mmap */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cache.h"
+#include "intern.h"
+#include "parser.h"
+#include "probes.h"
+#include "types.h"
+#include "consts.h"
+
+/* ===== CPP definitons =================================== */
+#define CACHE_MAGIC   "STC1"
+/* version of the meaning of the stored statements: to be bumped whenever a change to
+   "types.h" or "consts.h" changes what a stored field means, but not the layout */
+#define CACHE_VERSION 2
+#define CACHE_NAME    "%s/%08lx%08lx%08lx.stc"  /* dir, hashes & length of the source */
+#define CACHE_TEMP    "%s.%ld.tmp"  /* temporary file a blob is written to */
+#define HASH_CHUNK    4096
+
+/* ===== Declarations ===================================== */
+struct cache_header {
+  char magic[4];          /* CACHE_MAGIC                                          */
+  uint32_t version;       /* CACHE_VERSION                                        */
+  uint32_t layout;        /* layout_fingerprint(), as blobs are only valid for the
+                             build that wrote them                                */
+  uint32_t stms_cnt;      /* count of statements, without the STATEMENT_END one   */
+  uint32_t names_cnt;     /* count of label names                                 */
+  uint32_t names_size;    /* total size of the names, with their terminators      */
+  uint32_t payloads_size; /* total size of the payloads                           */
+};
+
+/* defined in "assembler.c" */
+extern char *filename;
+extern char *cache_dir;
+
+/* ----- prototypes --------------------------------------- */
+char* get_cache_path(FILE *source);
+Statement_t* load_cache(const char *path);
+void store_cache(const char *path, Statement_t *statements);
+
+static uint32_t layout_fingerprint();
+static long payload_size(Statement_t stm, const char *payload, long max);
+static char** payload_field(Statement_t *stm);
+static int map_label(int *label, int *ids, int names_cnt);
+static int map_labels(Statement_t *stm, int *ids, int names_cnt);
+
+
+/* ===== Code ============================================= */
+
+/*
+ * Returns the path of the blob of the source file in the cache directory,
+ * named after two hashes (FNV-1a & djb2) and the length of its contents.
+ * Returns NULL if the source can't be hashed (e.g. a pipe).
+ * The source is rewound, and the returned path should be freed by the caller.
+ */
+char*  /* path of the blob */
+get_cache_path(FILE *source)
+{
+  char chunk[HASH_CHUNK], *path;
+  unsigned long fnv = 2166136261UL, djb = 5381, len = 0;
+  size_t n, i;
+  if(0 != fseek(source, 0L, SEEK_SET))
+    return NULL;
+  while(0 != (n = fread(chunk, 1, HASH_CHUNK, source))) {
+    for(i=0; i<n; i++) {
+      fnv = ((fnv ^ (unsigned char)chunk[i]) * 16777619UL) & 0xFFFFFFFFUL;
+      djb = (djb * 33 + (unsigned char)chunk[i]) & 0xFFFFFFFFUL;
+    }
+    len += n;
+  }
+  if(ferror(source) || 0 != fseek(source, 0L, SEEK_SET))
+    return NULL;
+  path = malloc(strlen(cache_dir) + strlen(CACHE_NAME) + 3*8);
+  sprintf(path, CACHE_NAME, cache_dir, fnv, djb, len & 0xFFFFFFFFUL);
+  return path;
+}
+
+
+/*
+ * Returns a hash of the layout of the stored statements: the sizes & offsets of their
+ * fields, and the values of the enumerators they hold (the last of each enumeration),
+ * so that blobs of a build that changed any of them aren't loaded.
+ */
+static uint32_t  /* the fingerprint */
+layout_fingerprint()
+{
+  static const long layout[] = {
+    sizeof(Statement_t), offsetof(Statement_t, label), offsetof(Statement_t, inst),
+    sizeof(Op_t), offsetof(OpInstruction_t, op), offsetof(struct ItypeOp, immed),
+    offsetof(struct JtypeOp, addr), offsetof(struct JtypeOp, reg),
+    sizeof(Dir_t), offsetof(DirInstruction_t, dir), offsetof(struct AtypeDir, argv),
+    offsetof(struct NtypeDir, argv), offsetof(struct BtypeDir, argv),
+    STATEMENT_END, DIR_FILL, OP_STOP, OP_LI, OP_CALL, OP_SH
+  };
+  const unsigned char *bytes = (const unsigned char *)layout;
+  uint32_t hash = 2166136261UL;  /* FNV-1a */
+  size_t i;
+  for(i=0; i < sizeof(layout); i++)
+    hash = (hash ^ bytes[i]) * 16777619UL;
+  return hash;
+}
+
+
+/*
+ * Returns a pointer to the pointer field of stm (a string or an array),
+ * or NULL if stm has none.
+ */
+static char**  /* the pointer field */
+payload_field(Statement_t *stm)
+{
+  if(stm->type != STATEMENT_DIRECTIVE)
+    return NULL;
+  switch(stm->inst.di_inst.dirid) {
+    case DIR_ASCIZ:
+      return &stm->inst.di_inst.dir.Sdir.str;
+    case DIR_INCBIN:
+      return &stm->inst.di_inst.dir.Bdir.path;
+    case DIR_DB:
+    case DIR_DH:
+    case DIR_DW:
+      return (char **)&stm->inst.di_inst.dir.Adir.argv;
+    default:
+      return NULL;
+  }
+}
+
+
+/*
+ * Returns the size of the payload of stm (a string, with its terminator, or an array)
+ * stored at payload, of which at most max bytes are available.
+ * Returns -1 if the payload doesn't fit in max bytes.
+ */
+static long  /* size of the payload */
+payload_size(Statement_t stm, const char *payload, long max)
+{
+  const char *end;
+  long size;
+  switch(stm.inst.di_inst.dirid) {
+    case DIR_ASCIZ:
+    case DIR_INCBIN:
+      end = memchr(payload, '\0', max);
+      return end == NULL ? -1 : end - payload + 1;
+    case DIR_DB: size = 1; break;
+    case DIR_DH: size = 2; break;
+    default:     size = 4; break;  /* .dw */
+  }
+  size *= stm.inst.di_inst.dir.Adir.argc;
+  return size > max ? -1 : size;
+}
+
+
+/*
+ * Maps the id of a label in a blob to the id its name was interned with (in ids).
+ * Local labels (negative ids) and 0 (no label) are kept.
+ * Returns -1 if the id isn't the id of a name in the blob, else 0.
+ */
+static int  /* nonzero on failure */
+map_label(int *label, int *ids, int names_cnt)
+{
+  if(*label <= 0)
+    return 0;
+  if(*label > names_cnt)
+    return -1;
+  *label = ids[*label];
+  return 0;
+}
+
+
+/*
+ * Maps the ids of all labels of a statement loaded from a blob (see map_label).
+ * Returns -1 if any of them isn't the id of a name in the blob, else 0.
+ */
+static int  /* nonzero on failure */
+map_labels(Statement_t *stm, int *ids, int names_cnt)
+{
+  OpInstruction_t *op_inst = &stm->inst.op_inst;
+  enum DirId dirid = stm->inst.di_inst.dirid;
+  if(0 != map_label(&stm->label, ids, names_cnt))
+    return -1;
+  if(stm->type == STATEMENT_OPERATION && IS_BRANCH_OP(op_inst->opcode))
+    return map_label(&op_inst->op.Iop.label, ids, names_cnt);
+  if(stm->type == STATEMENT_OPERATION && OPCODE_TO_OPTYPE(op_inst->opcode) == OPTYPE_J
+     && !(op_inst->opcode == OP_JMP && op_inst->op.Jop.reg))
+    return map_label(&op_inst->op.Jop.label, ids, names_cnt);
+  if(stm->type == STATEMENT_DIRECTIVE && (dirid == DIR_ENTRY || dirid == DIR_EXTERN))
+    return map_label(&stm->inst.di_inst.dir.Sdir.label, ids, names_cnt);
+  return 0;
+}
+
+
+/*
+ * Loads the array of statements from the blob at path, interning its label names.
+ * Returns the array (terminated by a STATEMENT_END statement), or NULL if there's
+ * no valid blob at path, in which case the file should be parsed instead.
+ * The returned array should be freed by the caller, as one returned by parse_file.
+ */
+Statement_t*  /* the statements */
+load_cache(const char *path)
+{
+  struct cache_header header;
+  struct stat st;
+  Statement_t *statements = NULL, *stm;
+  char *map = MAP_FAILED, **field;
+  const char *name, *payloads;
+  long i, size, offset, stms_offset;
+  int *ids = NULL, fd;
+  if(-1 == (fd = open(path, O_RDONLY)))
+    return NULL;
+  if(fstat(fd, &st) == -1 || st.st_size < sizeof(header))
+    goto Fail;
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if(map == MAP_FAILED)
+    goto Fail;
+  memcpy(&header, map, sizeof(header));
+  stms_offset = sizeof(header) + header.names_size;
+  if(0 != memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic))
+     || header.version != CACHE_VERSION || header.layout != layout_fingerprint()
+     || st.st_size != stms_offset + (long)header.stms_cnt * sizeof(Statement_t)
+                      + header.payloads_size)
+    goto Fail;
+  PROBE2(phase__start, "cache", filename);
+
+  /* intern the names, mapping the ids of the blob to their ids */
+  ids = malloc((header.names_cnt + 1) * sizeof(int));
+  for(i=1, name = map + sizeof(header); i <= header.names_cnt; i++) {
+    size = map + stms_offset - name;
+    if(NULL == memchr(name, '\0', size))
+      goto Fail;
+    ids[i] = intern(name, strlen(name));
+    name += strlen(name) + 1;
+  }
+
+  statements = malloc((header.stms_cnt + 1) * sizeof(Statement_t));
+  memcpy(statements, map + stms_offset, header.stms_cnt * sizeof(Statement_t));
+  payloads = map + stms_offset + header.stms_cnt * sizeof(Statement_t);
+  for(i=0, offset=0; i < header.stms_cnt; i++) {
+    stm = &statements[i];
+    if(0 != map_labels(stm, ids, header.names_cnt))
+      break;
+    if(NULL == (field = payload_field(stm)))
+      continue;
+    if(-1 == (size = payload_size(*stm, payloads + offset, header.payloads_size - offset)))
+      break;
+    *field = malloc(size + 1);
+    memcpy(*field, payloads + offset, size);
+    offset += size;
+  }
+  if(i < header.stms_cnt) {  /* invalid - free the payloads copied so far */
+    while(i-- > 0)
+      free_statement(statements[i]);
+    free(statements);
+    statements = NULL;
+    goto Fail;
+  }
+  statements[header.stms_cnt].type = STATEMENT_END;
+  PROBE3(phase__done, "cache", filename, header.stms_cnt);
+Fail:
+  free(ids);
+  if(map != MAP_FAILED)
+    munmap(map, st.st_size);
+  close(fd);
+  return statements;
+}
+
+
+/*
+ * Stores the array of statements (terminated by a STATEMENT_END statement),
+ * along with the interned label names, in a blob at path.
+ * The blob is written into a temporary file that replaces it once complete,
+ * so a blob is never read while partly written. Failures are silently ignored,
+ * as the file is simply parsed again on its next run.
+ */
+void
+store_cache(const char *path, Statement_t *statements)
+{
+  struct cache_header header;
+  Statement_t stm, *stmp;
+  char *temppath, **field;
+  long size;
+  int i, ok;
+  FILE *file;
+
+  memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+  header.version = CACHE_VERSION;
+  header.layout = layout_fingerprint();
+  header.stms_cnt = header.names_size = header.payloads_size = 0;
+  header.names_cnt = interned_cnt() - 1;
+  for(i=1; i <= header.names_cnt; i++)
+    header.names_size += strlen(get_name(i)) + 1;
+  for(stmp = statements; stmp->type != STATEMENT_END; stmp++, header.stms_cnt++) {
+    if(NULL != (field = payload_field(stmp)))
+      header.payloads_size += payload_size(*stmp, *field, LONG_MAX);
+  }
+
+  mkdir(cache_dir, 0777);  /* if it exists already, it simply fails */
+  temppath = malloc(strlen(path) + strlen(CACHE_TEMP) + 3*sizeof(long));
+  sprintf(temppath, CACHE_TEMP, path, (long)getpid());
+  if(NULL == (file = fopen(temppath, "w"))) {
+    free(temppath);
+    return;
+  }
+  ok = 1 == fwrite(&header, sizeof(header), 1, file);
+  for(i=1; ok && i <= header.names_cnt; i++)
+    ok = 1 == fwrite(get_name(i), strlen(get_name(i)) + 1, 1, file);
+  for(stmp = statements; ok && stmp->type != STATEMENT_END; stmp++) {
+    stm = *stmp;
+    if(NULL != (field = payload_field(&stm)))
+      *field = NULL;  /* pointers are meaningless in the blob */
+    ok = 1 == fwrite(&stm, sizeof(stm), 1, file);
+  }
+  for(stmp = statements; ok && stmp->type != STATEMENT_END; stmp++) {
+    if(NULL == (field = payload_field(stmp)))
+      continue;
+    size = payload_size(*stmp, *field, LONG_MAX);
+    ok = size == 0 || 1 == fwrite(*field, size, 1, file);
+  }
+  if(0 == fclose(file) && ok)
+    rename(temppath, path);
+  else
+    remove(temppath);
+  free(temppath);
+}
@@ -0,0 +1,18 @@
+/* ===== cache.h ==========================================
+ * Header file for "cache.c".
+ * Exposes get_cache_path, load_cache & store_cache, for the cache of parsed
+ * source files (--cache=DIR).
+ */
+#ifndef CACHE_H
+#define CACHE_H
+
+
+#include <stdio.h>
+#include "types.h"
+
+char* get_cache_path(FILE *source);
+Statement_t* load_cache(const char *path);
+void store_cache(const char *path, Statement_t *statements);
+
+
+#endif
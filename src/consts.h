@@ -13,13 +13,46 @@
 #define MAX_LABEL_LEN   32
 #define MAX_LINE_LEN    80
 #define LINE_BUFFER_SIZE (MAX_LINE_LEN*10)
-#define MAX_PROG_MEMORY  (MAX_PROG_LINES * MAX_LINE_LEN / 2)
+#define MAX_PROG_MEMORY  (MAX_PROG_LINES * MAX_LINE_LEN / 2)  /* initial size of the memory image */
 
 /* ----- syntax --------------------------------- */
 #define COMMENT_CHAR ';'
+#define PARAM_CHAR '\\'   /* prefix of the parameters in the body of a macro */
+#define MACRO_DIR ".macro"  /* starts a macro definition */
+#define ENDM_DIR  ".endm"   /* ends a macro definition   */
+
+/* ----- local labels --------------------------- */
+/* Local labels ("1:", referenced as "1b" - backward, or "1f" - forward) are numbered
+ * 0 to LOCAL_LABELS_CNT-1. Each of their definitions is identified by a negative id:
+ * the nth (0-based) id handed out in a pass over a file is LOCAL_LABEL_ID(n),
+ * so the ids can't run out before the file has INT_MAX local label terms. */
+#define LOCAL_LABEL_DIGITS 4
+#define LOCAL_LABELS_CNT   10000
+#define LOCAL_LABEL_ID(n)  (-(n) - 1)
+#define IS_LOCAL_LABEL(id) ((id) < 0)
 
 /* ----- encoding ------------------------------- */
 #define INITIAL_IC  100
+/* evaluates to 1 iff x is in bounds of signed int with n bits */
+#define IN_BOUNDS(x,n) ((~0 << ((n)-1) <= (x)) && ((x) <= ~(~0 << ((n)-1))))
+
+/* ----- cmdline options ------------------------ */
+/* bitwise-OR'd into the options variable defined in "assembler.c" */
+#define OPT_PEEPHOLE    (1 << 0)  /* -O: run the peephole optimization pass      */
+#define OPT_THREAD      (1 << 1)  /* --thread-jumps: run the jump threading pass */
+#define OPT_DCE         (1 << 2)  /* --dce: run the dead code elimination pass   */
+#define OPT_MERGE_DATA  (1 << 3)  /* --merge-data: share identical data payloads */
+#define OPT_ALIGN_DATA  (1 << 4)  /* --align-data: align .dh/.dw data naturally  */
+#define OPT_ESTIMATE    (1 << 5)  /* --estimate: report estimated cycle counts   */
+#define OPT_STDOUT      (1 << 6)  /* --stdout: stream the outputs to stdout      */
+#define OPT_LOW_MEMORY  (1 << 7)  /* --low-memory: stream the source file        */
+#define OPT_JOBS        (1 << 8)  /* --jobs: encode instructions in parallel     */
+#define MAX_JOBS        64        /* maximal value of --jobs                     */
+#define OPT_STATUS      (1 << 9)  /* --status: print a status line per file      */
+#define OPT_IF_CHANGED  (1 << 10) /* --if-changed: keep unchanged output files   */
+#define OPT_CHECK       (1 << 11) /* --check: only report diagnostics            */
+#define OPT_LSP         (1 << 12) /* --lsp: run the language server on stdio     */
+#define OPT_CACHE       (1 << 13) /* --cache: cache parsed source files          */
 
 /* ----- tokenization --------------------------- */
 #define WSPACE_CHARS " \f\n\r\t\v"
@@ -32,6 +65,7 @@
 #define ENC_RTYPE_FUNCT_POS (6)
 #define ENC_IOP_IMMED_MASK  (0xFFFF)
 #define ENC_JOP_ADDR_MASK   (0x1FFFFFF)
+#define MAX_ADDRESS         ENC_JOP_ADDR_MASK  /* highest address of a label, as la encodes it */
 #define ENC_JOP_REG_POS     (25)
 
 
@@ -75,7 +109,9 @@ enum OpId {
   OP_JMP  = 30,
   OP_LA   = 31,
   OP_CALL = 32,
-  OP_STOP = 63
+  OP_STOP = 63,
+  /* pseudo-operations - expanded by the parser into the above, never encoded */
+  OP_LI   = 62
 };
 
 
@@ -1,11 +1,12 @@
 /* ===== errors.c =========================================
  * This module contains methods for fomratting and outputting
- * the various errors into stdout.
+ * the various errors into stdout (or stderr, see msgout).
  * All error ids are definited in the header file "errors.h".
  */
 
 /* ===== Includes ========================================= */
 #include <stdio.h>
+#include <stdarg.h>
 #include <ctype.h>
 #include "errors.h"
 #include "parser.h"
@@ -16,8 +17,11 @@
 #define COLOR_RED       "\033[0;31m"  /* red           */
 #define COLOR_WHITE_B   "\033[1;37m"  /* bold white    */
 #define COLOR_PURPLE_B  "\033[1;35m"  /* bold purple   */
+#define COLOR_CYAN_B    "\033[1;36m"  /* bold cyan     */
 #define COLOR_RESET     "\033[0m"     /* default color */
 
+#define MACRO_NOTE COLOR_CYAN_B" note:"COLOR_RESET" in expansion of this macro line"
+
 /* padding macros to determine count of whitespace characters when printing errors */
 #define PADDING1(x)   ((x) < 10 ? 2 : (x) < 100 ? 1 : 0)
 #define PADDING2(x,y) (PADDING1(x) + PADDING1(y) - 1)
@@ -25,17 +29,22 @@
 /* ===== Declarations ===================================== */
 extern char *filename;  /* defined in "assembler.c" */
 int error_occurred;     /* 0 iff no errors occured */
+FILE *msgout;           /* stream errors, warnings & notes are printed into,
+                           stdout unless the outputs are streamed into it */
 
 /* ----- prototypes --------------------------------------- */
 void print_error(Error_t error);
+void print_note(const char *format, ...);
+void write_errstr(FILE *out, Error_t error);
 static void print_errstr_unexpectedtok(long flags);
 static void print_errstr(Error_t error);
+static void print_line(int line_ind, const char *line, int tok_ind);
 static const char* err_to_string(enum ErrId id);
 
 /* ===== Code ============================================= */
 
 /*
- * Pretty prints the unexpected token error to stdout.
+ * Pretty prints the unexpected token error to msgout.
  * The flags parameter is the flags field of the Error_t struct.
  * In this context, it is a bitwise-OR of the EXP_* flags defined in "parser.h"
  * and determines the info text that is provided in the error message.
@@ -48,10 +57,10 @@ print_errstr_unexpectedtok(long flags)
   int i = 0;
   char *expected_toks[10], c;
   if(flags == EXP_END) {
-    printf("unexpected token");
+    fprintf(msgout, "unexpected token");
     return;
   }
-  printf("expected ");
+  fprintf(msgout, "expected ");
   if(flags & EXP_LABELDEF)
     expected_toks[i++] = LABELDEF_TOK_NAME;
   if(flags & EXP_REG)
@@ -70,14 +79,14 @@ print_errstr_unexpectedtok(long flags)
   /* print 'a' or 'an' with respect to the first character of the next word
    * (wheter it is a vowel or not). Yes, probably very unnecessary. */
   c = tolower(expected_toks[--i][0]);
-  (c == 'a' || c == 'e' || c == 'i' || c == 'o' || c == 'u') ? printf("an ") : printf("a ");
+  (c == 'a' || c == 'e' || c == 'i' || c == 'o' || c == 'u') ? fprintf(msgout, "an ") : fprintf(msgout, "a ");
 
   /* print the list of expected tokens */
   for(; i > 1; i--)
-    printf("%s, ", (expected_toks[i]));
+    fprintf(msgout, "%s, ", (expected_toks[i]));
   if (i>0)
-    printf("%s or ", (expected_toks[1]));
-  printf("%s", (expected_toks[0]));
+    fprintf(msgout, "%s or ", (expected_toks[1]));
+  fprintf(msgout, "%s", (expected_toks[0]));
 }
 
 /*
@@ -91,18 +100,32 @@ print_errstr(Error_t error)
   switch(errid) {
     /* syntax errors */
     case EUNEXPECTED_EOL:
-      printf("%s", err_to_string(EUNEXPECTED_EOL));
-      printf("; ");
+      fprintf(msgout, "%s", err_to_string(EUNEXPECTED_EOL));
+      fprintf(msgout, "; ");
     case EUNKNOWN_TOK:
     case EUNEXPECTED_TOK:
       print_errstr_unexpectedtok(error.flags);
       break;
     default:
-      printf("%s", err_to_string(errid));
+      fprintf(msgout, "%s", err_to_string(errid));
     }
 }
 
 
+/*
+ * Writes the error information string of error into out
+ * (as print_errstr does into msgout).
+ */
+void
+write_errstr(FILE *out, Error_t error)
+{
+  FILE *saved = msgout;
+  msgout = out;
+  print_errstr(error);
+  msgout = saved;
+}
+
+
 /*
  * Returns the error string of the given error.
  */
@@ -120,9 +143,11 @@ err_to_string(enum ErrId id) {
 
 
 /*
- * Pretty-prints the syntax error to stdout.
+ * Pretty-prints the syntax error to msgout.
  * Includes the filename, erroneous line number, position in line,
  * the erroneous line itself and an error information message.
+ * An error in a statement expanded from a macro is reported at the line of the call,
+ * followed by a note that points at the erroneous token in the macro line.
  * Also makes use of ANSI color escape sequences for colored output.
  */
 void
@@ -130,44 +155,81 @@ print_error(Error_t error)
 {
   int i;
   int padding;    /* used to align all error messages */
+  int in_macro    /* 1 iff the statement was expanded from a macro */
+    = error.macro_line > 0;
   int has_tok     /* 1 iff the error specifies an erroneous token       */
     = error.tok.ind >= 0;
-  int has_line    /* 1 iff the error includes the erroneous line string */ 
-    = error.line != NULL;
   int is_warning  /* 1 iff the error is non critical (a warning) */
     = error.errid != 0 && error.errid > ___WARNINGS___;
 
   /* error base (same for all errors) */
-  printf(COLOR_WHITE_B"%s:%d:", filename, error.line_ind);
+  fprintf(msgout, COLOR_WHITE_B"%s:%d:", filename, error.line_ind);
 
   /* decide padding */
-  if(has_tok) {
+  if(has_tok && !in_macro) {
     /* the error specifies the erroneous token */
-    printf("%d:", error.tok.ind);
+    fprintf(msgout, "%d:", error.tok.ind);
     padding = PADDING2(error.line_ind, error.tok.ind);
   } else { 
-    /* the error does not specify the erroneous token */
+    /* the error does not specify the erroneous token (or it's in the macro line) */
     padding = PADDING1(error.line_ind);
   }
-  for(i=0; i<padding; i++) printf(" ");
+  for(i=0; i<padding; i++) fprintf(msgout, " ");
 
   /* print error/warning appropriatley */
   if(is_warning)
-    printf(COLOR_PURPLE_B" warning:"COLOR_RESET" ");
+    fprintf(msgout, COLOR_PURPLE_B" warning:"COLOR_RESET" ");
   else
-    printf(COLOR_RED_B" error:"COLOR_RESET" ");
+    fprintf(msgout, COLOR_RED_B" error:"COLOR_RESET" ");
   print_errstr(error);
 
-  /* if provided, include the erroneous line */
-  if(has_line) {
-    printf("\n%4d | \t%s", error.line_ind, error.line);
-    printf("     | \t");
+  if(!in_macro) {
+    print_line(error.line_ind, error.line, has_tok ? error.tok.ind : -1);
+    return;
   }
 
-  /* if provided, specifiey the erroneous token */
-  if(has_line && has_tok) {
-    for (i=0; i<error.tok.ind-1; i++) printf(error.line[i] == '\t' ? "\t" : " ");
-    printf(COLOR_RED"^^^"COLOR_RESET);  
+  /* expanded from a macro: the line of the call, then the macro line with the token */
+  print_line(error.line_ind, error.call_line, -1);
+  fprintf(msgout, COLOR_WHITE_B"%s:%d:", filename, error.macro_line);
+  if(has_tok)
+    fprintf(msgout, "%d:", error.tok.ind);
+  fprintf(msgout, MACRO_NOTE);
+  print_line(error.macro_line, error.line, has_tok ? error.tok.ind : -1);
+}
+
+
+/*
+ * Ends the message line of print_error, followed by the line (if not NULL)
+ * with the given index, and a caret under its token at tok_ind (if not negative).
+ */
+static void
+print_line(int line_ind, const char *line, int tok_ind)
+{
+  int i;
+
+  if(line != NULL) {
+    fprintf(msgout, "\n%4d | \t%s", line_ind, line);
+    fprintf(msgout, "     | \t");
+    if(tok_ind >= 0) {
+      for (i=0; i<tok_ind-1; i++) fprintf(msgout, line[i] == '\t' ? "\t" : " ");
+      fprintf(msgout, COLOR_RED"^^^"COLOR_RESET);  
+    }
   }
-  printf("\n");
+  fprintf(msgout, "\n");
+}
+
+
+/*
+ * Prints an informational note regarding the currently assembled file to msgout.
+ * format and the following arguments are as in printf.
+ */
+void
+print_note(const char *format, ...)
+{
+  va_list args;
+  fprintf(msgout, COLOR_WHITE_B"%s:"COLOR_CYAN_B" note:"COLOR_RESET" ", filename);
+  va_start(args, format);
+  vfprintf(msgout, format, args);
+  va_end(args);
+  fprintf(msgout, "\n");
 }
@@ -1,6 +1,7 @@
 /* ===== errors.h =========================================
  * Header file for "errors.c".
- * Exposes the module's main function: print_error.
+ * Exposes the module's main function: print_error, print_note for informational messages,
+ * and write_errstr for writing the message of an error alone.
  * Defines the following:
  *  - Error strings of the various errors.
  *  - Printable token names for the various token types.
@@ -33,6 +34,14 @@
 	X(		EINVAL_LABEL,          "label name is a reserved word") \
 	X(		ELONG_LABEL,           "label name exceeds character limit") \
 	X(		ELONG_LINE,            "line exceeds character limit") \
+	X(		EINVAL_ALIGN,          "alignment must be a positive power of 2") \
+	X(		EINVAL_FILL_SIZE,      "fill size must be 1, 2 or 4") \
+	X(		ELOCAL_LABEL_DECL,     "local label can't be declared entry or external") \
+	X(		EINVAL_MACRO,          "invalid macro name or parameters") \
+	X(		EMACRO_REDEF,          "macro defined more than once") \
+	X(		EMACRO_NO_END,         "macro definition is missing .endm") \
+	X(		EMACRO_ARGS,           "wrong count of macro arguments") \
+	X(		EMACRO_LABEL,          "no statement of the macro can take the label of its call") \
 	X(		ELABEL_UNDEFINED,      "refrence to undefined label") \
 	X(		ELABEL_SCOPE_MISMATCH, "label defined as both external and an entry") \
 	X(		ELABEL_EXT_DEF,        "label declared external but defined in file") \
@@ -41,6 +50,11 @@
 	X(		ELABEL_EXP_CODE,       "expected a code label") \
 	X(		ELABEL_ENT_UNDEF,      "label declared entry but not defined in file") \
 	X(		ELABEL_UNEXP_EXT,      "external label operand to branch operation") \
+	X(		EBRANCH_RANGE,         "branch target is out of range") \
+	X(		EINCBIN_READ,          "can't read included binary file") \
+	X(		EINCBIN_RANGE,         "offset and length exceed included binary file") \
+	X(		EDATA_RANGE,           "data exceeds the address space") \
+	X(		EDATA_MEMORY,          "not enough memory for the data") \
   X(    ___WARNINGS___,        "") \
 	X(		WLABEL_JMP2DATA,       "attempted jump to data symbol") \
 	X(		WLABEL_DEF_ENTRY,      "redundant label definition on .entry statement") \
@@ -62,10 +76,16 @@ typedef struct Error {
   Token_t tok;       /* the erroneous token        */
   char *line;        /* the erroneous line         */
   int line_ind;      /* the erroneous line's index */
+  int macro_line;    /* if the line was expanded from a macro:
+                        the index of the macro line, else 0 */
+  char *call_line;   /* if the line was expanded from a macro: the line of
+                        the call (line holds the macro line), else NULL */
   long flags;        /* error-specific flags       */
 } Error_t;
 
 
 void print_error(Error_t error);
+void print_note(const char *format, ...);
+void write_errstr(FILE *out, Error_t error);
 
 #endif
@@ -0,0 +1,326 @@
+/* ===== estimate.c =======================================
+ * This module statically estimates the count of cycles the assembled program would
+ * take on a simple in-order, single-issue pipeline - without running it.
+ * Each operation is assigned an issue cost (cycles it occupies the issue stage) and a
+ * latency (cycles until its result may be used by a following operation).
+ * - An operation reading a register whose value isn't ready yet stalls until it is,
+ *   e.g: an operation using the result of the load right before it (load-use hazard).
+ * - A taken jump costs an additional branch penalty, for refilling the pipeline.
+ *   Conditional branches are predicted statically: backward branches (loops) are
+ *   taken and forward branches are not.
+ * The estimate is reported per basic block (see "flow.c"), per loop and per function.
+ * A function starts at the first operation and at each label that is an operand of
+ * a call operation or is declared an entry.
+ *
+ * The default costs may be overridden by a cost model file, in which each line is either:
+ *    <operation> <issue> <latency>     e.g: "lw 1 3"
+ *    branch_penalty <cycles>           e.g: "branch_penalty 2"
+ * Empty lines and lines starting with ';' are ignored.
+ */
+
+/* ===== Includes ========================================= */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "estimate.h"
+#include "flow.h"
+#include "intern.h"
+#include "tables.h"
+#include "types.h"
+#include "consts.h"
+
+/* ===== CPP definitons =================================== */
+#define COSTS_CNT (sizeof(costs) / sizeof(*costs))
+#define REGS_CNT  32
+
+/* ===== Declarations ===================================== */
+extern char *filename;  /* defined in "assembler.c" */
+extern FILE *msgout;    /* defined in "errors.c" */
+
+static int branch_penalty = 2;  /* cycles lost on a taken jump */
+
+/* ----- prototypes --------------------------------------- */
+int load_cost_model(const char *path);
+void estimate_cycles(Statement_t *statements);
+
+static struct op_cost* search_cost(enum OpId id);
+static int get_operands(OpInstruction_t op_inst, int *srcs, int *dst);
+static int is_taken_jump(BasicBlock_t *blocks, int i);
+static long estimate_block(BasicBlock_t *block, int taken, long *stalls);
+static void print_block_name(BasicBlock_t *block);
+
+
+/* ===== Cost table ======================================= */
+struct op_cost {
+  enum OpId id;
+  int issue;    /* cycles the operation occupies the issue stage      */
+  int latency;  /* cycles until the result of the operation is ready  */
+} costs[] = {
+  {OP_ADD,  1, 1},
+  {OP_SUB,  1, 1},
+  {OP_AND,  1, 1},
+  {OP_OR,   1, 1},
+  {OP_NOR,  1, 1},
+  {OP_MOVE, 1, 1},
+  {OP_MVHI, 1, 1},
+  {OP_MVLO, 1, 1},
+  {OP_ADDI, 1, 1},
+  {OP_SUBI, 1, 1},
+  {OP_ANDI, 1, 1},
+  {OP_ORI,  1, 1},
+  {OP_NORI, 1, 1},
+  {OP_BNE,  1, 1},
+  {OP_BEQ,  1, 1},
+  {OP_BLT,  1, 1},
+  {OP_BGT,  1, 1},
+  {OP_LB,   1, 2},
+  {OP_SB,   1, 1},
+  {OP_LW,   1, 2},
+  {OP_SW,   1, 1},
+  {OP_LH,   1, 2},
+  {OP_SH,   1, 1},
+  {OP_JMP,  1, 1},
+  {OP_LA,   1, 1},
+  {OP_CALL, 1, 1},
+  {OP_STOP, 1, 1}
+};
+
+
+/* ===== Code ============================================= */
+
+/*
+ * Returns the cost table entry of the operation id.
+ */
+static struct op_cost*  /* the cost of the operation */
+search_cost(enum OpId id)
+{
+  int i;
+  for(i=0; i<COSTS_CNT; i++) {
+    if(costs[i].id == id)
+      return &costs[i];
+  }
+  return NULL;
+}
+
+
+/*
+ * Loads the cost model file at path, overriding the default costs.
+ * Returns -1 if the file can't be opened, the index of the first
+ * invalid line if there is one, else 0.
+ */
+int  /* nonzero on failure */
+load_cost_model(const char *path)
+{
+  FILE *file;
+  char line[LINE_BUFFER_SIZE], name[LINE_BUFFER_SIZE];
+  int line_ind = 0, issue, latency, fields, opid;
+  struct op_cost *cost;
+  if(NULL == (file = fopen(path, "r")))
+    return -1;
+  while(NULL != fgets(line, LINE_BUFFER_SIZE, file)) {
+    line_ind++;
+    fields = sscanf(line, "%s %d %d", name, &issue, &latency);
+    if(fields <= 0 || name[0] == COMMENT_CHAR)  /* empty line or comment */
+      continue;
+    if(fields == 2 && 0 == strcmp(name, "branch_penalty") && issue >= 0) {
+      branch_penalty = issue;
+      continue;
+    }
+    if(fields != 3 || issue < 1 || latency < 1
+      || -1 == (opid = search_op(name)) || NULL == (cost = search_cost(opid))) {
+      fclose(file);
+      return line_ind;
+    }
+    cost->issue = issue;
+    cost->latency = latency;
+  }
+  fclose(file);
+  return 0;
+}
+
+
+/*
+ * Stores the registers read by the operation in srcs, and the register
+ * written by it in dst (-1 if none).
+ * Returns the count of registers read.
+ */
+static int  /* count of registers read */
+get_operands(OpInstruction_t op_inst, int *srcs, int *dst)
+{
+  struct RtypeOp Rop = op_inst.op.Rop;
+  struct ItypeOp Iop = op_inst.op.Iop;
+  struct JtypeOp Jop = op_inst.op.Jop;
+  *dst = -1;
+  switch(get_opid(op_inst)) {
+    case OP_MOVE:
+      srcs[0] = Rop.rs; *dst = Rop.rd;
+      return 1;
+    case OP_MVHI:
+    case OP_MVLO:  /* only half of rd is written, the other half is kept */
+      srcs[0] = Rop.rs; srcs[1] = Rop.rd; *dst = Rop.rd;
+      return 2;
+    case OP_BNE:
+    case OP_BEQ:
+    case OP_BLT:
+    case OP_BGT:
+    case OP_SB:
+    case OP_SW:
+    case OP_SH:
+      srcs[0] = Iop.rs; srcs[1] = Iop.rt;
+      return 2;
+    case OP_JMP:
+      srcs[0] = Jop.addr;
+      return Jop.reg ? 1 : 0;
+    case OP_LA:
+    case OP_CALL:  /* the address/return address is stored in $0 */
+      *dst = 0;
+      return 0;
+    case OP_STOP:
+      return 0;
+    default:
+      break;
+  }
+  if(OPCODE_TO_OPTYPE(op_inst.opcode) == OPTYPE_R) {  /* arithmetic/logical */
+    srcs[0] = Rop.rs; srcs[1] = Rop.rt; *dst = Rop.rd;
+    return 2;
+  }
+  srcs[0] = Iop.rs; *dst = Iop.rt;  /* arithmetic/logical immediate & loads */
+  return 1;
+}
+
+
+/*
+ * Determines whether the last operation of block i is predicted to jump:
+ * jmp and call operations always are, branches only if they are backward.
+ */
+static int  /* 1 iff predicted taken */
+is_taken_jump(BasicBlock_t *blocks, int i)
+{
+  int opcode = blocks[i].last->inst.op_inst.opcode;
+  if(opcode == OP_JMP || opcode == OP_CALL)
+    return 1;
+  return IS_BRANCH_OP(opcode) && blocks[i].target != BLOCK_NONE && blocks[i].target <= i;
+}
+
+
+/*
+ * Returns the estimated count of cycles for executing the block once,
+ * starting with an empty pipeline. The count of stall cycles is stored in stalls.
+ * If taken is set, the branch penalty is added for the jump at its end.
+ */
+static long  /* the count of cycles */
+estimate_block(BasicBlock_t *block, int taken, long *stalls)
+{
+  long ready[REGS_CNT];  /* cycle at which each register's value is ready */
+  long cycle = 0, start;
+  int srcs[2], dst, nsrcs, i;
+  Statement_t *stm;
+  struct op_cost *cost;
+  memset(ready, 0, sizeof(ready));
+  *stalls = 0;
+  for(stm = block->first; stm <= block->last; stm++) {
+    if(stm->type != STATEMENT_OPERATION)
+      continue;
+    cost = search_cost(get_opid(stm->inst.op_inst));
+    nsrcs = get_operands(stm->inst.op_inst, srcs, &dst);
+    start = cycle;
+    for(i=0; i<nsrcs; i++)
+      if(ready[srcs[i]] > start) start = ready[srcs[i]];
+    *stalls += start - cycle;
+    cycle = start + cost->issue;
+    if(dst >= 0)
+      ready[dst] = start + cost->latency;
+  }
+  return cycle + (taken ? branch_penalty : 0);
+}
+
+
+/*
+ * Prints the name of a block - the label it starts at, if any.
+ * Local labels have no names (see LOCAL_LABEL_ID), and are printed as "-" as well.
+ */
+static void
+print_block_name(BasicBlock_t *block)
+{
+  int label = block->first->label;
+  fprintf(msgout, "%s", label != 0 && !IS_LOCAL_LABEL(label) ? get_name(label) : "-");
+}
+
+
+/*
+ * Estimates the cycles of the program and prints a report to msgout,
+ * per basic block, per loop (a backward jump and the blocks it jumps over),
+ * and per function.
+ */
+void
+estimate_cycles(Statement_t *statements)
+{
+  CodeLabel_t *labels, *label;
+  BasicBlock_t *blocks;
+  Statement_t *stm;
+  long *cycles, stalls, sum;
+  char *is_func;
+  int label_cnt, count, i, j, ops;
+
+  labels = build_label_table(statements, &label_cnt);
+  blocks = build_blocks(statements, labels, label_cnt, &count);
+  cycles = malloc((count + 1) * sizeof(long));
+  is_func = calloc(count + 1, sizeof(char));
+
+  /* functions start at the first block, call targets and entries */
+  is_func[0] = 1;
+  for(i=0; i<count; i++) {
+    if(blocks[i].last->inst.op_inst.opcode == OP_CALL && blocks[i].target != BLOCK_NONE)
+      is_func[blocks[i].target] = 1;
+  }
+  for(stm = statements; stm->type != STATEMENT_END; stm++) {
+    if(stm->type == STATEMENT_DIRECTIVE && stm->inst.di_inst.dirid == DIR_ENTRY
+      && NULL != (label = search_label(labels, label_cnt, stm->inst.di_inst.dir.Sdir.label))
+      && label->stm != NULL && BLOCK_NONE != (j = search_block(blocks, count, label->stm)))
+      is_func[j] = 1;
+  }
+
+  fprintf(msgout, "%s: cycle estimate (in-order pipeline, branch penalty %d)\n", filename, branch_penalty);
+  fprintf(msgout, "  %-8s %6s %6s %6s %6s  %s\n", "address", "line", "ops", "stalls", "cycles", "block");
+  for(i=0; i<count; i++) {
+    cycles[i] = estimate_block(&blocks[i], is_taken_jump(blocks, i), &stalls);
+    fprintf(msgout, "  %04ld     %6d %6d %6ld %6ld  ", blocks[i].ic + INITIAL_IC,
+        blocks[i].first->line_ind, blocks[i].size, stalls, cycles[i]);
+    print_block_name(&blocks[i]);
+    fprintf(msgout, "\n");
+  }
+
+  fprintf(msgout, "  %-8s %6s %6s %6s %6s  %s\n", "address", "line", "ops", "", "cycles", "loop");
+  for(i=0; i<count; i++) {
+    if(!IS_BRANCH_OP(blocks[i].last->inst.op_inst.opcode)
+      && blocks[i].last->inst.op_inst.opcode != OP_JMP)
+      continue;
+    if(blocks[i].target == BLOCK_NONE || blocks[i].target > i)
+      continue;
+    for(sum = 0, ops = 0, j = blocks[i].target; j <= i; j++) {
+      sum += cycles[j];
+      ops += blocks[j].size;
+    }
+    fprintf(msgout, "  %04ld     %6d %6d %6s %6ld  ", blocks[blocks[i].target].ic + INITIAL_IC,
+        blocks[blocks[i].target].first->line_ind, ops, "", sum);
+    print_block_name(&blocks[blocks[i].target]);
+    fprintf(msgout, " (per iteration)\n");
+  }
+
+  fprintf(msgout, "  %-8s %6s %6s %6s %6s  %s\n", "address", "line", "ops", "blocks", "cycles", "function");
+  for(i=0; i<count; i=j) {
+    for(sum = 0, ops = 0, j = i; j < count && (j == i || !is_func[j]); j++) {
+      sum += cycles[j];
+      ops += blocks[j].size;
+    }
+    fprintf(msgout, "  %04ld     %6d %6d %6d %6ld  ", blocks[i].ic + INITIAL_IC,
+        blocks[i].first->line_ind, ops, j - i, sum);
+    print_block_name(&blocks[i]);
+    fprintf(msgout, "\n");
+  }
+
+  free(is_func);
+  free(cycles);
+  free(blocks);
+  free(labels);
+}
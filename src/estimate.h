@@ -0,0 +1,15 @@
+/* ===== estimate.h =======================================
+ * Header file for "estimate.c".
+ * Exposes the cycle estimator: load_cost_model & estimate_cycles.
+ */
+#ifndef ESTIMATE_H
+#define ESTIMATE_H
+
+
+#include "types.h"
+
+int load_cost_model(const char *path);
+void estimate_cycles(Statement_t *statements);
+
+
+#endif
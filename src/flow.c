@@ -0,0 +1,218 @@
+/* ===== flow.c ===========================================
+ * This module analyzes the control flow of the array of statements that was
+ * produced by "parser.c", before "scan.c" assigns addresses to them.
+ * It is used by the optimization passes of "optimize.c".
+ * 1. The code label table - a sorted array of the labels defined on operation
+ *    statements (and of the labels declared external), along with the IC each
+ *    labelled statement would be assigned with.
+ * 2. Basic blocks - maximal runs of operation statements that are only entered
+ *    at their first statement and only left at their last one.
+ */
+
+/* ===== Includes ========================================= */
+#include <stdlib.h>
+#include "flow.h"
+#include "types.h"
+#include "consts.h"
+
+/* ===== CPP definitons =================================== */
+/* evaluates to 1 iff control doesn't simply continue to the next operation after opcode */
+#define ENDS_BLOCK(opcode) (IS_BRANCH_OP(opcode) \
+  || (opcode) == OP_JMP || (opcode) == OP_CALL || (opcode) == OP_STOP)
+
+/* ===== Declarations ===================================== */
+/* ----- prototypes --------------------------------------- */
+enum OpId get_opid(OpInstruction_t op_inst);
+int* get_target_label(OpInstruction_t *op_inst);
+CodeLabel_t* build_label_table(Statement_t *statements, int *count);
+CodeLabel_t* search_label(CodeLabel_t *table, int count, int name);
+BasicBlock_t* build_blocks(Statement_t *statements, CodeLabel_t *labels, int label_cnt, int *count);
+int search_block(BasicBlock_t *blocks, int count, Statement_t *stm);
+
+static int label_cmp(const void *label1, const void *label2);
+static int find_target_block(BasicBlock_t *blocks, int count,
+                             CodeLabel_t *labels, int label_cnt, int name);
+
+
+/* ===== Code ============================================= */
+
+/*
+ * Returns the operation id (as defined in enum OpId) of an operation instruction.
+ * For R-type operations, the id is composed of both the opcode and funct fields.
+ */
+enum OpId  /* the operation id */
+get_opid(OpInstruction_t op_inst)
+{
+  if(OPCODE_TO_OPTYPE(op_inst.opcode) == OPTYPE_R)
+    return op_inst.op.Rop.funct << FUNCT_SHIFT | op_inst.opcode;
+  return op_inst.opcode;
+}
+
+
+/*
+ * Returns a pointer to the target label field of jmp, call and branch operations.
+ * Returns NULL for operations that don't take a label (including jmp $reg).
+ */
+int*  /* pointer to the label field */
+get_target_label(OpInstruction_t *op_inst)
+{
+  if(IS_BRANCH_OP(op_inst->opcode))
+    return &op_inst->op.Iop.label;
+  if(op_inst->opcode == OP_CALL
+    || (op_inst->opcode == OP_JMP && !op_inst->op.Jop.reg))
+    return &op_inst->op.Jop.label;
+  return NULL;
+}
+
+
+/* ===== Code label table ================================= */
+
+/*
+ * Comparison function between the name ids of code labels to be used as a comparison key.
+ */
+static int
+label_cmp(const void *label1, const void *label2)
+{
+  const CodeLabel_t * const plabel1 = label1;
+  const CodeLabel_t * const plabel2 = label2;
+  return (plabel1->name > plabel2->name) - (plabel1->name < plabel2->name);
+}
+
+
+/*
+ * Builds a table of all labels defined on operation statements along with
+ * the IC each of them would be assigned, and all labels declared external.
+ * The table is sorted for efficient searching, its size is stored in count.
+ * The returned table should be freed by the caller.
+ */
+CodeLabel_t*  /* the code label table */
+build_label_table(Statement_t *statements, int *count)
+{
+  CodeLabel_t *table;
+  Statement_t *stm;
+  long ic = 0;
+  int n = 0;
+  for(stm = statements; stm->type != STATEMENT_END; stm++) n++;
+  table = malloc((n + 1) * sizeof(CodeLabel_t));
+
+  n = 0;
+  for(stm = statements; stm->type != STATEMENT_END; stm++) {
+    if(stm->type == STATEMENT_OPERATION) {
+      if(stm->label != 0) {
+        table[n].name = stm->label;
+        table[n].stm = stm;
+        table[n++].ic = ic;
+      }
+      ic += 4;
+    } else if(stm->type == STATEMENT_DIRECTIVE
+           && stm->inst.di_inst.dirid == DIR_EXTERN) {
+      table[n].name = stm->inst.di_inst.dir.Sdir.label;
+      table[n].stm = NULL;
+      table[n++].ic = -1;
+    }
+  }
+  qsort(table, n, sizeof(CodeLabel_t), label_cmp);
+  *count = n;
+  return table;
+}
+
+
+/*
+ * Searches name in the code label table,
+ * if found - returns a pointer to its entry, else returns NULL.
+ */
+CodeLabel_t*  /* the table entry */
+search_label(CodeLabel_t *table, int count, int name)
+{
+  CodeLabel_t key;
+  key.name = name;
+  return bsearch(&key, table, count, sizeof(CodeLabel_t), label_cmp);
+}
+
+
+/* ===== Basic blocks ===================================== */
+
+/*
+ * Returns the index of the block whose first statement is stm,
+ * or BLOCK_NONE if there is no such block.
+ */
+int  /* index of the block */
+search_block(BasicBlock_t *blocks, int count, Statement_t *stm)
+{
+  int low = 0, high = count - 1, mid;
+  while(low <= high) {  /* blocks are ordered by the address of their first statement */
+    mid = (low + high) / 2;
+    if(blocks[mid].first == stm)
+      return mid;
+    if(blocks[mid].first < stm)
+      low = mid + 1;
+    else
+      high = mid - 1;
+  }
+  return BLOCK_NONE;
+}
+
+
+/*
+ * Returns the index of the block starting at the code label name,
+ * or BLOCK_NONE if name isn't a code label defined in the file.
+ */
+static int  /* index of the block */
+find_target_block(BasicBlock_t *blocks, int count,
+                  CodeLabel_t *labels, int label_cnt, int name)
+{
+  CodeLabel_t *label;
+  if(name == 0 || NULL == (label = search_label(labels, label_cnt, name))
+    || label->stm == NULL)
+    return BLOCK_NONE;
+  return search_block(blocks, count, label->stm);
+}
+
+
+/*
+ * Splits the operation statements into basic blocks.
+ * A block starts at the first operation, at each labelled operation and after each
+ * jmp, call, branch or stop operation; and its successors are set according to its
+ * last operation. Successors that can't be determined statically
+ * (jmp $reg, external labels) are set to BLOCK_NONE.
+ * labels is the code label table of the statements (see build_label_table).
+ * The count of blocks is stored in count, the returned array should be freed by the caller.
+ */
+BasicBlock_t*  /* the basic blocks, ordered by IC */
+build_blocks(Statement_t *statements, CodeLabel_t *labels, int label_cnt, int *count)
+{
+  BasicBlock_t *blocks, *block = NULL;
+  Statement_t *stm;
+  int *labelp;
+  int opcode, n = 0, i;
+  long ic = 0;
+  for(stm = statements; stm->type != STATEMENT_END; stm++)
+    if(stm->type == STATEMENT_OPERATION) n++;
+  blocks = malloc((n + 1) * sizeof(BasicBlock_t));
+
+  n = 0;
+  for(stm = statements; stm->type != STATEMENT_END; stm++) {
+    if(stm->type != STATEMENT_OPERATION)
+      continue;
+    if(block == NULL || stm->label != 0 || ENDS_BLOCK(block->last->inst.op_inst.opcode)) {
+      block = &blocks[n++];
+      block->first = stm;
+      block->ic = ic;
+      block->size = 0;
+    }
+    block->last = stm;
+    block->size++;
+    ic += 4;
+  }
+
+  /* set successors */
+  for(i=0; i<n; i++) {
+    opcode = blocks[i].last->inst.op_inst.opcode;
+    labelp = get_target_label(&blocks[i].last->inst.op_inst);
+    blocks[i].next = (i+1 < n && opcode != OP_JMP && opcode != OP_STOP) ? i+1 : BLOCK_NONE;
+    blocks[i].target = labelp == NULL ? BLOCK_NONE :
+                       find_target_block(blocks, n, labels, label_cnt, *labelp);
+  }
+  *count = n;
+  return blocks;
+}
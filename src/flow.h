@@ -0,0 +1,40 @@
+/* ===== flow.h ===========================================
+ * Header file for "flow.c".
+ * Defines the following types, used to analyze the control flow of the parsed statements:
+ *  CodeLabel_t  - An entry of the code label table.
+ *  BasicBlock_t - A basic block of operation statements.
+ * Exposes functions for building and searching the code label table and basic blocks.
+ */
+#ifndef FLOW_H
+#define FLOW_H
+
+
+#include "types.h"
+
+#define BLOCK_NONE (-1)  /* successor which isn't a basic block of the file */
+
+typedef struct CodeLabel {
+  int name;           /* id of the label's name (see "intern.c")              */
+  Statement_t *stm;   /* the operation statement defining the label,
+                         NULL for labels declared external                    */
+  long ic;            /* IC the statement would be assigned with              */
+} CodeLabel_t;
+
+typedef struct BasicBlock {
+  Statement_t *first; /* first operation statement of the block               */
+  Statement_t *last;  /* last operation statement of the block                */
+  long ic;            /* IC the first statement would be assigned with        */
+  int size;           /* count of operation statements in the block           */
+  int next;           /* block reached by falling through the last statement  */
+  int target;         /* block reached by jumping from the last statement     */
+} BasicBlock_t;
+
+enum OpId get_opid(OpInstruction_t op_inst);
+int* get_target_label(OpInstruction_t *op_inst);
+CodeLabel_t* build_label_table(Statement_t *statements, int *count);
+CodeLabel_t* search_label(CodeLabel_t *table, int count, int name);
+BasicBlock_t* build_blocks(Statement_t *statements, CodeLabel_t *labels, int label_cnt, int *count);
+int search_block(BasicBlock_t *blocks, int count, Statement_t *stm);
+
+
+#endif
@@ -0,0 +1,169 @@
+/* ===== intern.c =========================================
+ * This module interns the names of labels: each distinct name is stored once,
+ * and is identified by an id - a positive integer handed out in order of first
+ * appearance, which remains stable until the interner is cleaned up.
+ * The id 0 is never handed out, and denotes "no label".
+ * Statements, references and the symbol table carry ids instead of strings,
+ * so comparing two names amounts to comparing two integers, and the names
+ * only have to be looked up when they're printed.
+ * Names are stored back to back in a growable buffer, and found by a
+ * chained hash table (FNV-1a) that is doubled whenever it gets full.
+ */
+
+/* ===== Includes ========================================= */
+#include <stdlib.h>
+#include <string.h>
+#include "intern.h"
+
+/* ===== CPP definitons =================================== */
+#define IDS_INIT    256         /* initial count of ids (and buckets)    */
+#define NAMES_INIT  (IDS_INIT * 8)  /* initial size of the names buffer  */
+
+/* ===== Declarations ===================================== */
+/* an interned name */
+struct interned {
+  uint32_t hash;  /* hash of the name                          */
+  long offset;    /* offset of the name in the names buffer    */
+  int next;       /* id of the next name in the bucket, or 0   */
+};
+
+static struct interned *ids;  /* the interned names, indexed by id (0 is unused) */
+static int ids_cnt, ids_max;
+static int *buckets;          /* id of the first name in each bucket, or 0       */
+static char *names;           /* the null-terminated names, back to back         */
+static long names_size, names_max;
+
+/* ----- prototypes --------------------------------------- */
+void init_interner();
+void cleanup_interner();
+int intern(const char *name, size_t len);
+const char* get_name(int id);
+int interned_cnt();
+
+static uint32_t hash_name(const char *name, size_t len);
+static void grow_ids();
+
+
+/* ===== Code ============================================= */
+
+/*
+ * Returns the FNV-1a hash of the len characters of name.
+ */
+static uint32_t  /* the hash */
+hash_name(const char *name, size_t len)
+{
+  uint32_t hash = 2166136261UL;
+  size_t i;
+  for(i=0; i<len; i++) {
+    hash ^= (unsigned char)name[i];
+    hash *= 16777619UL;
+  }
+  return hash;
+}
+
+
+/*
+ * Initializes the interner.
+ * Discards previously interned names.
+ */
+void
+init_interner()
+{
+  ids_cnt = 1;  /* id 0 is reserved */
+  ids_max = IDS_INIT;
+  ids = malloc(ids_max * sizeof(struct interned));
+  buckets = calloc(ids_max, sizeof(int));
+  names_size = 0;
+  names_max = NAMES_INIT;
+  names = malloc(names_max);
+}
+
+
+/*
+ * Frees up all memory used by the interner.
+ */
+void
+cleanup_interner()
+{
+  free(ids);
+  free(buckets);
+  free(names);
+  ids = NULL;
+  buckets = NULL;
+  names = NULL;
+}
+
+
+/*
+ * Doubles the count of ids and of buckets, and rehashes the interned names,
+ * keeping the bucket chains short.
+ */
+static void
+grow_ids()
+{
+  int id, bucket;
+  ids_max *= 2;
+  ids = realloc(ids, ids_max * sizeof(struct interned));
+  buckets = realloc(buckets, ids_max * sizeof(int));
+  memset(buckets, 0, ids_max * sizeof(int));
+  for(id=1; id<ids_cnt; id++) {
+    bucket = ids[id].hash & (ids_max - 1);
+    ids[id].next = buckets[bucket];
+    buckets[bucket] = id;
+  }
+}
+
+
+/*
+ * Interns the len characters of name (which need not be null-terminated).
+ * Returns the id of the name, the same id is returned for all equal names.
+ */
+int  /* the id of the name */
+intern(const char *name, size_t len)
+{
+  uint32_t hash = hash_name(name, len);
+  int id;
+  for(id = buckets[hash & (ids_max - 1)]; id != 0; id = ids[id].next) {
+    if(ids[id].hash == hash && 0 == strncmp(&names[ids[id].offset], name, len)
+      && names[ids[id].offset + len] == '\0')
+      return id;
+  }
+  /* name not interned before */
+  if(ids_cnt == ids_max)
+    grow_ids();
+  while(names_size + len + 1 > names_max) {
+    names_max *= 2;
+    names = realloc(names, names_max);
+  }
+  id = ids_cnt++;
+  ids[id].hash = hash;
+  ids[id].offset = names_size;
+  ids[id].next = buckets[hash & (ids_max - 1)];
+  buckets[hash & (ids_max - 1)] = id;
+  memcpy(&names[names_size], name, len);
+  names[names_size + len] = '\0';
+  names_size += len + 1;
+  return id;
+}
+
+
+/*
+ * Returns the name interned with id.
+ * The returned string is only valid until the next call to intern.
+ */
+const char*  /* the name */
+get_name(int id)
+{
+  return &names[ids[id].offset];
+}
+
+
+/*
+ * Returns the count of ids handed out so far, plus 1 (for the reserved id 0),
+ * i.e. the size of an array indexed by id.
+ */
+int  /* the count of ids */
+interned_cnt()
+{
+  return ids_cnt;
+}
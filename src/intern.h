@@ -0,0 +1,19 @@
+/* ===== intern.h =========================================
+ * Header file for "intern.c".
+ * Exposes the interner of label names: intern, get_name & interned_cnt.
+ */
+#ifndef INTERN_H
+#define INTERN_H
+
+
+#include <stdlib.h>
+#include <stdint.h>
+
+void init_interner();
+void cleanup_interner();
+int intern(const char *name, size_t len);
+const char* get_name(int id);
+int interned_cnt();
+
+
+#endif
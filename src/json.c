@@ -0,0 +1,311 @@
+/* ===== json.c ===========================================
+ * A minimal JSON parser & writer, as required by the language server (see "lsp.c").
+ * A JSON text is parsed into a tree of Json_t values: the elements of an array
+ * (or members of an object) are a linked list of children, in order.
+ * Members are looked up by a dotted path of keys, e.g: "params.textDocument.uri".
+ * Strings are unescaped into UTF-8, and escaped back when written.
+ */
+
+/* ===== Includes ========================================= */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "json.h"
+
+/* ===== CPP definitons =================================== */
+#define MAX_DEPTH 64  /* maximal nesting of arrays & objects */
+
+/* ===== Declarations ===================================== */
+static const char *next;  /* the rest of the parsed text */
+
+/* ----- prototypes --------------------------------------- */
+Json_t* json_parse(const char *text);
+void json_free(Json_t *json);
+Json_t* json_get(Json_t *json, const char *path);
+void json_write_string(FILE *out, const char *str);
+
+static Json_t* parse_value(int depth);
+static char* parse_string();
+static int parse_hex4();
+static int skip_literal(const char *literal);
+static void skip_wspace();
+
+
+/* ===== Code ============================================= */
+
+/*
+ * Skips the whitespace characters at the start of the rest of the text.
+ */
+static void
+skip_wspace()
+{
+  while(*next == ' ' || *next == '\t' || *next == '\n' || *next == '\r')
+    next++;
+}
+
+
+/*
+ * Skips literal if the rest of the text starts with it.
+ * Returns 1 if it was skipped, else 0.
+ */
+static int  /* 1 iff skipped */
+skip_literal(const char *literal)
+{
+  size_t len = strlen(literal);
+  if(0 != strncmp(next, literal, len))
+    return 0;
+  next += len;
+  return 1;
+}
+
+
+/*
+ * Parses the 4 hex digits of a \u escape sequence.
+ * Returns their value, or -1 if they aren't 4 hex digits.
+ */
+static int  /* the value */
+parse_hex4()
+{
+  int i, value = 0;
+  for(i=0; i<4; i++, next++) {
+    if(!isxdigit((unsigned char)*next))
+      return -1;
+    value = value * 16
+      + (isdigit((unsigned char)*next) ? *next - '0' : tolower((unsigned char)*next) - 'a' + 10);
+  }
+  return value;
+}
+
+
+/*
+ * Parses the string at the start of the rest of the text (which starts with '"').
+ * Returns the unescaped string, or NULL if it isn't a valid string.
+ * The returned string should be freed by the caller.
+ */
+static char*  /* the string */
+parse_string()
+{
+  const char *end;
+  char *str, *c;
+  long code, low;
+  for(end = ++next; *end != '"'; end++) {
+    if(*end == '\0')
+      return NULL;
+    if(*end == '\\' && *++end == '\0')
+      return NULL;
+  }
+  c = str = malloc(end - next + 1);  /* unescaping never lengthens a string */
+  while(*next != '"') {
+    if(*next != '\\') {
+      *c++ = *next++;
+      continue;
+    }
+    switch(*++next) {
+      case 'b': *c++ = '\b'; next++; break;
+      case 'f': *c++ = '\f'; next++; break;
+      case 'n': *c++ = '\n'; next++; break;
+      case 'r': *c++ = '\r'; next++; break;
+      case 't': *c++ = '\t'; next++; break;
+      case 'u':
+        next++;
+        if(-1 == (code = parse_hex4()))
+          goto Error;
+        if(code >= 0xD800 && code < 0xDC00 && skip_literal("\\u")) {  /* surrogate pair */
+          if(-1 == (low = parse_hex4()))
+            goto Error;
+          code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+        }
+        /* encode the code point in UTF-8 */
+        if(code < 0x80) {
+          *c++ = code;
+        } else if(code < 0x800) {
+          *c++ = 0xC0 | (code >> 6);
+          *c++ = 0x80 | (code & 0x3F);
+        } else if(code < 0x10000) {
+          *c++ = 0xE0 | (code >> 12);
+          *c++ = 0x80 | ((code >> 6) & 0x3F);
+          *c++ = 0x80 | (code & 0x3F);
+        } else {
+          *c++ = 0xF0 | (code >> 18);
+          *c++ = 0x80 | ((code >> 12) & 0x3F);
+          *c++ = 0x80 | ((code >> 6) & 0x3F);
+          *c++ = 0x80 | (code & 0x3F);
+        }
+        break;
+      default:  /* '"', '\\' or '/' */
+        *c++ = *next++;
+    }
+  }
+  next++;
+  *c = '\0';
+  return str;
+Error:
+  free(str);
+  return NULL;
+}
+
+
+/*
+ * Parses the value at the start of the rest of the text,
+ * nested in depth arrays & objects.
+ * Returns the value, or NULL if it isn't a valid value.
+ */
+static Json_t*  /* the value */
+parse_value(int depth)
+{
+  Json_t *json, **last;
+  char *end;
+  if(depth > MAX_DEPTH)
+    return NULL;
+  skip_wspace();
+  json = calloc(1, sizeof(Json_t));
+  if(*next == '{' || *next == '[') {
+    json->type = *next == '{' ? JSON_OBJECT : JSON_ARRAY;
+    next++;
+    skip_wspace();
+    last = &json->child;
+    if(*next == (json->type == JSON_OBJECT ? '}' : ']')) {
+      next++;
+      return json;
+    }
+    for(;;) {
+      char *key = NULL;
+      if(json->type == JSON_OBJECT) {
+        skip_wspace();
+        if(*next != '"' || NULL == (key = parse_string()))
+          goto Error;
+        skip_wspace();
+        if(*next++ != ':') {
+          free(key);
+          goto Error;
+        }
+      }
+      if(NULL == (*last = parse_value(depth + 1))) {
+        free(key);
+        goto Error;
+      }
+      (*last)->key = key;
+      last = &(*last)->next;
+      skip_wspace();
+      if(*next == ',') {
+        next++;
+        continue;
+      }
+      if(*next++ != (json->type == JSON_OBJECT ? '}' : ']'))
+        goto Error;
+      return json;
+    }
+  }
+  if(*next == '"') {
+    json->type = JSON_STRING;
+    if(NULL == (json->str = parse_string()))
+      goto Error;
+  } else if(skip_literal("true")) {
+    json->type = JSON_BOOL;
+    json->num = 1;
+  } else if(skip_literal("false")) {
+    json->type = JSON_BOOL;
+  } else if(skip_literal("null")) {
+    json->type = JSON_NULL;
+  } else {
+    json->type = JSON_NUMBER;
+    json->num = strtod(next, &end);
+    if(end == next)
+      goto Error;
+    next = end;
+  }
+  return json;
+Error:
+  json_free(json);
+  return NULL;
+}
+
+
+/*
+ * Parses a JSON text.
+ * Returns the parsed value, or NULL if text isn't valid JSON.
+ * The returned value should be freed by the caller (see json_free).
+ */
+Json_t*  /* the value */
+json_parse(const char *text)
+{
+  Json_t *json;
+  next = text;
+  json = parse_value(0);
+  skip_wspace();
+  if(json != NULL && *next != '\0') {
+    json_free(json);
+    return NULL;
+  }
+  return json;
+}
+
+
+/*
+ * Frees up a parsed value, along with all its elements (or members).
+ */
+void
+json_free(Json_t *json)
+{
+  Json_t *child, *next_child;
+  if(json == NULL)
+    return;
+  for(child = json->child; child != NULL; child = next_child) {
+    next_child = child->next;
+    json_free(child);
+  }
+  free(json->key);
+  free(json->str);
+  free(json);
+}
+
+
+/*
+ * Returns the member of json at path - a dot-separated list of keys of nested objects,
+ * e.g: json_get(request, "params.position.line").
+ * If there's no such member, returns NULL.
+ */
+Json_t*  /* the member */
+json_get(Json_t *json, const char *path)
+{
+  Json_t *member;
+  size_t len;
+  while(json != NULL && *path != '\0') {
+    len = strcspn(path, ".");
+    if(json->type != JSON_OBJECT)
+      return NULL;
+    for(member = json->child; member != NULL; member = member->next) {
+      if(strlen(member->key) == len && 0 == strncmp(member->key, path, len))
+        break;
+    }
+    json = member;
+    path += len + (path[len] == '.');
+  }
+  return json;
+}
+
+
+/*
+ * Writes str into out as a JSON string (quoted and escaped).
+ */
+void
+json_write_string(FILE *out, const char *str)
+{
+  fputc('"', out);
+  for(; *str != '\0'; str++) {
+    switch(*str) {
+      case '"':  fputs("\\\"", out); break;
+      case '\\': fputs("\\\\", out); break;
+      case '\n': fputs("\\n", out); break;
+      case '\r': fputs("\\r", out); break;
+      case '\t': fputs("\\t", out); break;
+      default:
+        if((unsigned char)*str < 0x20)
+          fprintf(out, "\\u%04x", *str);
+        else
+          fputc(*str, out);
+    }
+  }
+  fputc('"', out);
+}
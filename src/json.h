@@ -0,0 +1,36 @@
+/* ===== json.h ===========================================
+ * Header file for "json.c".
+ * Defines the Json_t type of parsed JSON values, and exposes
+ * json_parse, json_free, json_get & json_write_string.
+ */
+#ifndef JSON_H
+#define JSON_H
+
+
+#include <stdio.h>
+
+enum JsonType {
+  JSON_NULL,
+  JSON_BOOL,
+  JSON_NUMBER,
+  JSON_STRING,
+  JSON_ARRAY,
+  JSON_OBJECT
+};
+
+typedef struct Json {
+  enum JsonType type;
+  char *key;            /* key of the value, if it's a member of an object    */
+  char *str;            /* value of a string                                  */
+  double num;           /* value of a number, or of a bool (0 or 1)           */
+  struct Json *child;   /* first element (or member) of an array (or object)  */
+  struct Json *next;    /* next element (or member) of the parent             */
+} Json_t;
+
+Json_t* json_parse(const char *text);
+void json_free(Json_t *json);
+Json_t* json_get(Json_t *json, const char *path);
+void json_write_string(FILE *out, const char *str);
+
+
+#endif
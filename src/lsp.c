@@ -0,0 +1,1050 @@
+/* ===== lsp.c ============================================
+ * This module implements a language server for the assembly language (--lsp),
+ * speaking JSON-RPC over stdin & stdout as specified by the Language Server Protocol.
+ * Supported: diagnostics, go-to-definition and find-references.
+ *
+ * Every open document is kept in memory as an array of lines, each along with
+ * its parsed statement (see parse_statement). Instead of a symbol table, which
+ * is built in order and can't be patched, every document keeps an index of labels:
+ * for each label, the sets of lines defining it, referencing it as an operand,
+ * and declaring it an entry or external (see enum Role).
+ * On an edit, only the changed lines are parsed again, and only their labels are
+ * removed from (and added to) the index. The diagnostics of the label checks of
+ * "scan.c" are derived from the index, line by line (see diagnose_line), and kept
+ * along with the lines: only the changed lines, and the lines sharing a label with
+ * them, are diagnosed again. The diagnosed lines are kept in a set of their own,
+ * so publishing the diagnostics doesn't scan the whole document.
+ *
+ * Macros are followed as the parser does (see parse_source_line): the lines of a
+ * macro definition are not statements, and neither is a call of a macro, except for
+ * the label it defines. Since a line's kind depends on the lines before it, every
+ * change classifies the whole document again (see classify_lines) - comparing only
+ * the first terms of the lines - and only the lines whose kind changed are parsed again.
+ *
+ * Positions are in bytes: the source is expected to be ASCII, where bytes and the
+ * UTF-16 code units of the protocol are the same.
+ */
+
+/* ===== Includes ========================================= */
+#define _POSIX_C_SOURCE 200809L  /* open_memstream */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "lsp.h"
+#include "json.h"
+#include "parser.h"
+#include "tokenizer.h"
+#include "intern.h"
+#include "errors.h"
+#include "types.h"
+#include "consts.h"
+
+/* ===== CPP definitons =================================== */
+#define CONTENT_LENGTH    "Content-Length:"
+#define HEADER_SIZE       256   /* maximal length of a header line      */
+#define BODY_MAX          (1L << 26)  /* maximal length of a message body */
+#define LINES_INIT        1024  /* initial count of lines of a document */
+#define SET_INIT          4     /* initial size of a set of lines       */
+#define SEVERITY_ERROR    1
+#define SEVERITY_WARNING  2
+#define ERR_PARSE         -32700  /* JSON-RPC error codes */
+#define ERR_NO_METHOD     -32601
+#define CAPABILITIES      "{\"capabilities\":{\"textDocumentSync\":{\"openClose\":true,\"change\":2},"\
+                          "\"definitionProvider\":true,\"referencesProvider\":true}}"
+
+/* ===== Declarations ===================================== */
+/* roles of a label in a statement */
+enum Role {
+  ROLE_DEF,     /* defined by the statement                  */
+  ROLE_REF,     /* referenced by the operation as an operand */
+  ROLE_ENTRY,   /* declared an entry                         */
+  ROLE_EXTERN,  /* declared external                         */
+  ROLES_CNT
+};
+
+/* kinds of lines, by their part in the macros of a document */
+enum Kind {
+  KIND_NEW = -1,    /* not classified yet                       */
+  KIND_STATEMENT,   /* a statement                              */
+  KIND_MACRO,       /* the start of a macro definition (.macro) */
+  KIND_BODY,        /* a line of the body of a macro definition */
+  KIND_ENDM,        /* the end of a macro definition (.endm)    */
+  KIND_CALL         /* a call of a macro                        */
+};
+
+/* a line of a document */
+struct line {
+  char *text;       /* the line, without its newline                 */
+  Statement_t stm;  /* the parsed statement                          */
+  Error_t error;    /* the syntax error of the line, errid 0 if none */
+  enum Kind kind;   /* the kind of the line, see classify_lines      */
+  int ind;          /* index of the line in the document (0-based)   */
+  int diag;         /* error id of the diagnostic of the line, 0 if none   */
+  int diag_label;   /* id of the label the diagnostic concerns, 0 if none  */
+  int diag_ind;     /* index of the line in the set of diagnosed lines, or -1 */
+};
+
+/* an unordered set of lines */
+struct line_set {
+  struct line **lines;
+  int cnt, max;
+};
+
+/* the lines a label appears in, by its role */
+struct label {
+  struct line_set sets[ROLES_CNT];
+};
+
+/* an open document */
+struct document {
+  char *uri;
+  struct line **lines;    /* the lines, in order            */
+  int lines_cnt, lines_max;
+  struct label *labels;   /* the index of labels, by id     */
+  int labels_cnt;
+  struct line_set diagnosed;  /* the lines with a diagnostic, unordered */
+  struct document *next;  /* next open document             */
+};
+
+static struct document *documents;  /* the open documents */
+
+/* ----- prototypes --------------------------------------- */
+int run_lsp(FILE *in, FILE *out);
+
+static void get_roles(struct line *line, int roles[ROLES_CNT]);
+static void set_add(struct line_set *set, struct line *line);
+static void set_remove(struct line_set *set, struct line *line);
+static struct label* get_label(struct document *doc, int id);
+static void index_line(struct document *doc, struct line *line, int add);
+static struct line* new_line(const char *text, size_t len);
+static void parse_text(struct line *line);
+static const char* get_term(const char *text, int n, size_t *len);
+static int is_term(const char *term, size_t len, const char *str);
+static void classify_lines(struct document *doc, struct line_set *changed);
+static void free_line(struct line *line);
+static void set_diagnostic(struct document *doc, struct line *line, int errid, int label);
+static void update_label(struct document *doc, int label);
+static void replace_lines(struct document *doc, int first, int count, const char *text);
+static void apply_change(struct document *doc, Json_t *change);
+static struct document* find_document(const char *uri);
+static void open_document(const char *uri, const char *text);
+static void close_document(struct document *doc);
+static struct line* first_line(struct line_set *set);
+static int diagnose_line(struct document *doc, struct line *line, int *label);
+static int compare_lines(const void *a, const void *b);
+static int find_label(const char *text, const char *name, int is_def);
+static void get_error_range(struct line *line, int *start, int *end);
+static int label_at(struct document *doc, Json_t *params);
+static void write_range(FILE *out, int line, int start, int end);
+static void write_location(FILE *out, struct document *doc, struct line *line, int label, int is_def);
+static void write_diagnostics(FILE *out, struct document *doc);
+static void write_definition(FILE *out, struct document *doc, Json_t *params);
+static void write_references(FILE *out, struct document *doc, Json_t *params);
+static char* read_message(FILE *in);
+static void send_message(FILE *out, const char *body, size_t len);
+static void write_id(FILE *out, Json_t *id);
+
+
+/* ===== Code ============================================= */
+
+/*
+ * Stores the labels of the statement of line in roles, by their role (0 for none).
+ */
+static void
+get_roles(struct line *line, int roles[ROLES_CNT])
+{
+  Statement_t *stm = &line->stm;
+  int role;
+  memset(roles, 0, ROLES_CNT * sizeof(int));
+  if(stm->type == STATEMENT_OPERATION) {
+    roles[ROLE_DEF] = stm->label;
+    if(IS_BRANCH_OP(stm->inst.op_inst.opcode))
+      roles[ROLE_REF] = stm->inst.op_inst.op.Iop.label;
+    else if(stm->inst.op_inst.opcode == OP_LA || stm->inst.op_inst.opcode == OP_JMP
+         || stm->inst.op_inst.opcode == OP_CALL)
+      roles[ROLE_REF] = stm->inst.op_inst.op.Jop.label;
+  } else if(stm->type == STATEMENT_DIRECTIVE) {
+    if(stm->inst.di_inst.dirid == DIR_ENTRY)
+      roles[ROLE_ENTRY] = stm->inst.di_inst.dir.Sdir.label;
+    else if(stm->inst.di_inst.dirid == DIR_EXTERN)
+      roles[ROLE_EXTERN] = stm->inst.di_inst.dir.Sdir.label;
+    else  /* a label on .entry/.extern defines nothing, see WLABEL_DEF_ENTRY */
+      roles[ROLE_DEF] = stm->label;
+  } else if(stm->type == STATEMENT_IGNORE) {  /* only the label of a macro call */
+    roles[ROLE_DEF] = stm->label;
+  }
+  for(role=0; role<ROLES_CNT; role++)  /* local labels aren't indexed */
+    if(IS_LOCAL_LABEL(roles[role]))
+      roles[role] = 0;
+}
+
+
+/*
+ * Adds line to set.
+ */
+static void
+set_add(struct line_set *set, struct line *line)
+{
+  if(set->cnt == set->max) {
+    set->max = set->max == 0 ? SET_INIT : set->max * 2;
+    set->lines = realloc(set->lines, set->max * sizeof(struct line *));
+  }
+  set->lines[set->cnt++] = line;
+}
+
+
+/*
+ * Removes line from set (in which it must be).
+ */
+static void
+set_remove(struct line_set *set, struct line *line)
+{
+  int i;
+  for(i=0; i<set->cnt; i++) {
+    if(set->lines[i] == line) {
+      set->lines[i] = set->lines[--set->cnt];
+      return;
+    }
+  }
+}
+
+
+/*
+ * Returns the index entry of the label with the given id in doc,
+ * growing the index as labels are interned.
+ */
+static struct label*  /* the label */
+get_label(struct document *doc, int id)
+{
+  int cnt;
+  if(id >= doc->labels_cnt) {
+    cnt = interned_cnt() > 2*doc->labels_cnt ? interned_cnt() : 2*doc->labels_cnt;
+    doc->labels = realloc(doc->labels, cnt * sizeof(struct label));
+    memset(&doc->labels[doc->labels_cnt], 0, (cnt - doc->labels_cnt) * sizeof(struct label));
+    doc->labels_cnt = cnt;
+  }
+  return &doc->labels[id];
+}
+
+
+/*
+ * Adds (if add is set) or removes the labels of line to/from the index of doc.
+ */
+static void
+index_line(struct document *doc, struct line *line, int add)
+{
+  int roles[ROLES_CNT], role;
+  get_roles(line, roles);
+  for(role=0; role<ROLES_CNT; role++) {
+    if(roles[role] == 0)
+      continue;
+    if(add)
+      set_add(&get_label(doc, roles[role])->sets[role], line);
+    else
+      set_remove(&get_label(doc, roles[role])->sets[role], line);
+  }
+}
+
+
+/*
+ * Returns a new line of the len characters of text, to be classified
+ * and parsed (see classify_lines & parse_text).
+ */
+static struct line*  /* the line */
+new_line(const char *text, size_t len)
+{
+  struct line *line = malloc(sizeof(struct line));
+  if(len > 0 && text[len-1] == '\r')
+    len--;
+  line->text = malloc(len + 1);
+  memcpy(line->text, text, len);
+  line->text[len] = '\0';
+  line->error.errid = 0;
+  memset(&line->stm, 0, sizeof(Statement_t));
+  line->stm.type = STATEMENT_IGNORE;
+  line->kind = KIND_NEW;
+  line->diag = line->diag_label = 0;
+  line->diag_ind = -1;
+  return line;
+}
+
+
+/*
+ * Parses the text of line by its kind: a statement is parsed as such, the lines
+ * of a macro definition are ignored, and so is a macro call - except for the label
+ * it defines, whose id is stored in the (ignored) statement.
+ */
+static void
+parse_text(struct line *line)
+{
+  const char *term;
+  char *labeldef;
+  size_t len;
+  Token_t tok;
+  line->error.errid = 0;
+  memset(&line->stm, 0, sizeof(Statement_t));
+  line->stm.type = STATEMENT_IGNORE;
+  if(line->kind == KIND_STATEMENT) {
+    parse_statement(line->text, &line->stm, &line->error);
+  } else if(line->kind == KIND_CALL) {
+    term = get_term(line->text, 0, &len);
+    if(len == 0 || term[len-1] != ':')  /* the call doesn't define a label */
+      return;
+    labeldef = malloc(len + 1);
+    memcpy(labeldef, term, len);
+    labeldef[len] = '\0';
+    tok = tokenize_arg(labeldef);
+    if(tok.type == TOK_LABELDEF)
+      line->stm.label = tok.value.label;
+    else if(tok.type == TOK_STRING)
+      free(tok.value.str);
+    free(labeldef);
+  }
+}
+
+
+/*
+ * Returns the nth (0-based) whitespace-separated term of text,
+ * and stores its length in len (0 if there's no such term).
+ */
+static const char*  /* the term */
+get_term(const char *text, int n, size_t *len)
+{
+  const char *term = text + strspn(text, WSPACE_CHARS);
+  for(*len = strcspn(term, WSPACE_CHARS); n > 0; n--, *len = strcspn(term, WSPACE_CHARS)) {
+    term += *len;
+    term += strspn(term, WSPACE_CHARS);
+  }
+  return term;
+}
+
+
+/*
+ * Determines whether the len characters of term are str.
+ */
+static int  /* 1 iff they are */
+is_term(const char *term, size_t len, const char *str)
+{
+  return len == strlen(str) && 0 == strncmp(term, str, len);
+}
+
+
+/*
+ * Classifies all the lines of doc by their part in its macros, as the parser does:
+ * the lines from a .macro to its .endm define a macro, and a line that follows,
+ * whose first term (after a label definition) is the name of a macro, calls it.
+ * The lines whose kind changed, including the new lines, are added to changed.
+ */
+static void
+classify_lines(struct document *doc, struct line_set *changed)
+{
+  const char **names = NULL;  /* the names of the macros defined so far */
+  size_t *lens = NULL;        /* and their lengths */
+  int names_cnt = 0, defining = 0, i, j;
+  struct line *line;
+  const char *term;
+  size_t len;
+  enum Kind kind;
+  for(i=0; i<doc->lines_cnt; i++) {
+    line = doc->lines[i];
+    term = get_term(line->text, 0, &len);
+    if(defining) {
+      defining = !is_term(term, len, ENDM_DIR);
+      kind = defining ? KIND_BODY : KIND_ENDM;
+    } else if(is_term(term, len, MACRO_DIR)) {
+      defining = 1;
+      kind = KIND_MACRO;
+      names = realloc(names, (names_cnt + 1) * sizeof(char *));
+      lens = realloc(lens, (names_cnt + 1) * sizeof(size_t));
+      names[names_cnt] = get_term(line->text, 1, &len);
+      lens[names_cnt] = strcspn(names[names_cnt], WSPACE_CHARS ",;");
+      names_cnt++;
+    } else {
+      if(len > 0 && term[len-1] == ':')  /* the call may define a label */
+        term = get_term(line->text, 1, &len);
+      kind = KIND_STATEMENT;
+      for(j=0; j<names_cnt && kind == KIND_STATEMENT; j++)
+        if(len > 0 && lens[j] == len && 0 == strncmp(names[j], term, len))
+          kind = KIND_CALL;
+    }
+    if(kind != line->kind) {
+      line->kind = kind;
+      set_add(changed, line);
+    }
+  }
+  free(names);
+  free(lens);
+}
+
+
+/*
+ * Frees up a line.
+ */
+static void
+free_line(struct line *line)
+{
+  free_statement(line->stm);
+  free(line->text);
+  free(line);
+}
+
+
+/*
+ * Sets the diagnostic of line (errid 0 for none), adding it to (or removing it from)
+ * the set of diagnosed lines of doc.
+ */
+static void
+set_diagnostic(struct document *doc, struct line *line, int errid, int label)
+{
+  struct line_set *set = &doc->diagnosed;
+  line->diag = errid;
+  line->diag_label = label;
+  if(errid != 0 && line->diag_ind == -1) {
+    line->diag_ind = set->cnt;
+    set_add(set, line);
+  } else if(errid == 0 && line->diag_ind != -1) {
+    set->lines[line->diag_ind] = set->lines[--set->cnt];
+    set->lines[line->diag_ind]->diag_ind = line->diag_ind;
+    line->diag_ind = -1;
+  }
+}
+
+
+/*
+ * Diagnoses again all the lines of doc in which label appears.
+ */
+static void
+update_label(struct document *doc, int label)
+{
+  struct line_set *set;
+  int role, i, errid, diag_label;
+  for(role=0; role<ROLES_CNT; role++) {
+    set = &get_label(doc, label)->sets[role];
+    for(i=0; i<set->cnt; i++) {
+      errid = diagnose_line(doc, set->lines[i], &diag_label);
+      set_diagnostic(doc, set->lines[i], errid, diag_label);
+    }
+  }
+}
+
+
+/*
+ * Replaces count lines of doc, starting at line first, with the lines of text.
+ * Only the new lines, and the lines whose kind changed with them (see classify_lines),
+ * are parsed, and the index of labels is patched accordingly. Then these lines,
+ * and the lines sharing a label with them or with the replaced lines, are diagnosed again.
+ */
+static void
+replace_lines(struct document *doc, int first, int count, const char *text)
+{
+  struct line **added = NULL, *line;
+  struct line_set changed = {NULL, 0, 0};
+  const char *c, *end;
+  int *labels = NULL, labels_cnt = 0, roles[ROLES_CNT];
+  int added_cnt = 0, i, role, errid, label;
+  /* split text into lines */
+  for(c = text; ; c = end + 1) {
+    end = strchr(c, '\n');
+    if(end == NULL)
+      end = c + strlen(c);
+    added = realloc(added, (added_cnt + 1) * sizeof(struct line *));
+    added[added_cnt++] = new_line(c, end - c);
+    if(*end == '\0')
+      break;
+  }
+  labels = malloc(count * ROLES_CNT * sizeof(int));
+  for(i=first; i<first+count; i++) {
+    get_roles(doc->lines[i], roles);
+    for(role=0; role<ROLES_CNT; role++)
+      if(roles[role] != 0)
+        labels[labels_cnt++] = roles[role];
+    set_diagnostic(doc, doc->lines[i], 0, 0);
+    index_line(doc, doc->lines[i], 0);
+    free_line(doc->lines[i]);
+  }
+  /* make room for the added lines, and shift the following lines */
+  if(doc->lines_cnt - count + added_cnt > doc->lines_max) {
+    while(doc->lines_cnt - count + added_cnt > doc->lines_max)
+      doc->lines_max *= 2;
+    doc->lines = realloc(doc->lines, doc->lines_max * sizeof(struct line *));
+  }
+  memmove(&doc->lines[first + added_cnt], &doc->lines[first + count],
+          (doc->lines_cnt - first - count) * sizeof(struct line *));
+  memcpy(&doc->lines[first], added, added_cnt * sizeof(struct line *));
+  doc->lines_cnt += added_cnt - count;
+  for(i=first; i<first+added_cnt; i++)
+    doc->lines[i]->ind = i;
+  if(added_cnt != count)  /* the indices of the following lines changed */
+    for(; i<doc->lines_cnt; i++)
+      doc->lines[i]->ind = i;
+  /* parse the lines whose kind changed again */
+  classify_lines(doc, &changed);
+  labels = realloc(labels, (count + 2*changed.cnt) * ROLES_CNT * sizeof(int));
+  for(i=0; i<changed.cnt; i++) {
+    line = changed.lines[i];
+    get_roles(line, roles);
+    index_line(doc, line, 0);
+    free_statement(line->stm);
+    parse_text(line);
+    index_line(doc, line, 1);
+    for(role=0; role<ROLES_CNT; role++)
+      if(roles[role] != 0)
+        labels[labels_cnt++] = roles[role];
+    get_roles(line, roles);
+    for(role=0; role<ROLES_CNT; role++)
+      if(roles[role] != 0)
+        labels[labels_cnt++] = roles[role];
+  }
+  /* diagnose */
+  for(i=0; i<changed.cnt; i++) {
+    errid = diagnose_line(doc, changed.lines[i], &label);
+    set_diagnostic(doc, changed.lines[i], errid, label);
+  }
+  for(i=0; i<labels_cnt; i++)
+    update_label(doc, labels[i]);
+  free(changed.lines);
+  free(labels);
+  free(added);
+}
+
+
+/*
+ * Applies a change of a didChange notification to doc: either an incremental change
+ * of a range, or (without a range) the full text of the document.
+ */
+static void
+apply_change(struct document *doc, Json_t *change)
+{
+  Json_t *range = json_get(change, "range"), *text = json_get(change, "text");
+  int start_line, start_char, end_line, end_char;
+  char *joined;
+  struct line *first, *last;
+  if(text == NULL || text->type != JSON_STRING)
+    return;
+  if(range == NULL) {
+    replace_lines(doc, 0, doc->lines_cnt, text->str);
+    return;
+  }
+  start_line = json_get(range, "start.line")->num;
+  start_char = json_get(range, "start.character")->num;
+  end_line = json_get(range, "end.line")->num;
+  end_char = json_get(range, "end.character")->num;
+  /* clamp the range to the document */
+  if(start_line >= doc->lines_cnt) {
+    start_line = doc->lines_cnt - 1;
+    start_char = strlen(doc->lines[start_line]->text);
+  }
+  if(end_line >= doc->lines_cnt) {
+    end_line = doc->lines_cnt - 1;
+    end_char = strlen(doc->lines[end_line]->text);
+  }
+  first = doc->lines[start_line];
+  last = doc->lines[end_line];
+  if(start_char > strlen(first->text))
+    start_char = strlen(first->text);
+  if(end_char > strlen(last->text))
+    end_char = strlen(last->text);
+  /* the changed lines: the start of the first line, the text, and the end of the last line */
+  joined = malloc(start_char + strlen(text->str) + strlen(&last->text[end_char]) + 1);
+  memcpy(joined, first->text, start_char);
+  strcpy(&joined[start_char], text->str);
+  strcat(joined, &last->text[end_char]);
+  replace_lines(doc, start_line, end_line - start_line + 1, joined);
+  free(joined);
+}
+
+
+/*
+ * Returns the open document with the given uri, or NULL if there's none.
+ */
+static struct document*  /* the document */
+find_document(const char *uri)
+{
+  struct document *doc;
+  for(doc = documents; doc != NULL; doc = doc->next)
+    if(0 == strcmp(doc->uri, uri))
+      return doc;
+  return NULL;
+}
+
+
+/*
+ * Opens a document with the given uri and text.
+ */
+static void
+open_document(const char *uri, const char *text)
+{
+  struct document *doc = calloc(1, sizeof(struct document));
+  doc->uri = malloc(strlen(uri) + 1);
+  strcpy(doc->uri, uri);
+  doc->lines_max = LINES_INIT;
+  doc->lines = malloc(doc->lines_max * sizeof(struct line *));
+  replace_lines(doc, 0, 0, text);
+  doc->next = documents;
+  documents = doc;
+}
+
+
+/*
+ * Closes a document, freeing up all its memory.
+ */
+static void
+close_document(struct document *doc)
+{
+  struct document **docp;
+  int i, role;
+  for(docp = &documents; *docp != doc; docp = &(*docp)->next);
+  *docp = doc->next;
+  for(i=0; i<doc->lines_cnt; i++)
+    free_line(doc->lines[i]);
+  for(i=0; i<doc->labels_cnt; i++)
+    for(role=0; role<ROLES_CNT; role++)
+      free(doc->labels[i].sets[role].lines);
+  free(doc->lines);
+  free(doc->labels);
+  free(doc->diagnosed.lines);
+  free(doc->uri);
+  free(doc);
+}
+
+
+/*
+ * Returns the first line (in order of the document) of set.
+ */
+static struct line*  /* the line */
+first_line(struct line_set *set)
+{
+  struct line *first = set->lines[0];
+  int i;
+  for(i=1; i<set->cnt; i++)
+    if(set->lines[i]->ind < first->ind)
+      first = set->lines[i];
+  return first;
+}
+
+
+/*
+ * Determines the diagnostic of line: its syntax error, or else the first
+ * error (or warning) of the label checks of "scan.c" that applies to it,
+ * according to the index of labels.
+ * If the diagnostic concerns a label, its id is stored in label (else 0).
+ * Returns the error id of the diagnostic, or 0 if there's none.
+ */
+static int  /* the error id */
+diagnose_line(struct document *doc, struct line *line, int *label)
+{
+  int roles[ROLES_CNT];
+  struct label *lbl;
+  struct line *def;
+  int opcode = line->stm.inst.op_inst.opcode;
+  *label = 0;
+  if(line->error.errid != 0)
+    return line->error.errid;
+  get_roles(line, roles);
+  if(line->stm.type == STATEMENT_DIRECTIVE && line->stm.label != 0
+    && (roles[ROLE_ENTRY] || roles[ROLE_EXTERN])) {
+    *label = IS_LOCAL_LABEL(line->stm.label) ? 0 : line->stm.label;
+    return roles[ROLE_ENTRY] ? WLABEL_DEF_ENTRY : WLABEL_DEF_EXTERN;
+  }
+  if(0 != (*label = roles[ROLE_DEF])) {
+    lbl = get_label(doc, *label);
+    if(lbl->sets[ROLE_EXTERN].cnt > 0)
+      return ELABEL_EXT_DEF;
+    if(first_line(&lbl->sets[ROLE_DEF]) != line)
+      return ELABEL_DOUBLE_DEF;
+  }
+  if(0 != (*label = roles[ROLE_REF])) {
+    lbl = get_label(doc, *label);
+    def = lbl->sets[ROLE_DEF].cnt > 0 ? first_line(&lbl->sets[ROLE_DEF]) : NULL;
+    if(def == NULL && lbl->sets[ROLE_EXTERN].cnt == 0)
+      return ELABEL_UNDEFINED;
+    if(IS_BRANCH_OP(opcode) && lbl->sets[ROLE_EXTERN].cnt > 0)
+      return ELABEL_UNEXP_EXT;
+    if(opcode == OP_LA && def != NULL && def->stm.type == STATEMENT_OPERATION)
+      return ELABEL_EXP_DATA;
+    if(opcode != OP_LA && def != NULL && def->stm.type == STATEMENT_DIRECTIVE)
+      return WLABEL_JMP2DATA;
+  }
+  if(0 != (*label = roles[ROLE_ENTRY])) {
+    lbl = get_label(doc, *label);
+    if(lbl->sets[ROLE_EXTERN].cnt > 0)
+      return ELABEL_SCOPE_MISMATCH;
+    if(lbl->sets[ROLE_DEF].cnt == 0)
+      return ELABEL_ENT_UNDEF;
+  }
+  *label = 0;
+  return 0;
+}
+
+
+/*
+ * Compares two lines by their index in the document, for qsort.
+ */
+static int  /* negative, zero or positive */
+compare_lines(const void *a, const void *b)
+{
+  return (*(struct line **)a)->ind - (*(struct line **)b)->ind;
+}
+
+
+/*
+ * Returns the column of the label name in text: its first appearance if is_def is set
+ * (a label definition), else its last appearance before the comment (an operand).
+ * Returns -1 if it doesn't appear.
+ */
+static int  /* the column */
+find_label(const char *text, const char *name, int is_def)
+{
+  size_t len = strlen(name), end = strcspn(text, ";");
+  const char *c;
+  int col = -1;
+  for(c = strstr(text, name); c != NULL && c - text + len <= end; c = strstr(c + 1, name)) {
+    if((c > text && (isalnum((unsigned char)c[-1]) || c[-1] == '_'))
+      || isalnum((unsigned char)c[len]) || c[len] == '_')
+      continue;  /* part of a longer word */
+    col = c - text;
+    if(is_def)
+      break;
+  }
+  return col;
+}
+
+
+/*
+ * Stores the range of the erroneous token of the syntax error of line
+ * (or of the whole line, if the error has no token) in start & end.
+ */
+static void
+get_error_range(struct line *line, int *start, int *end)
+{
+  const char *text = line->text;
+  int len = strlen(text);
+  *start = 0;
+  *end = len;
+  if(line->error.tok.ind < 0 || line->error.tok.ind >= len)
+    return;
+  for(*start = line->error.tok.ind; *start < len && isspace((unsigned char)text[*start]); (*start)++);
+  for(*end = *start; *end < len && !isspace((unsigned char)text[*end]) && text[*end] != ','; (*end)++);
+  if(*end == *start)
+    *end = len;
+}
+
+
+/*
+ * Returns the id of the label at the position (params.position) of a request in doc,
+ * or 0 if there's no label there.
+ */
+static int  /* the id of the label */
+label_at(struct document *doc, Json_t *params)
+{
+  Json_t *line = json_get(params, "position.line"), *col = json_get(params, "position.character");
+  const char *text;
+  int start, end;
+  if(line == NULL || col == NULL || line->num < 0 || line->num >= doc->lines_cnt)
+    return 0;
+  text = doc->lines[(int)line->num]->text;
+  start = end = col->num;
+  if(end > strlen(text))
+    return 0;
+  while(start > 0 && (isalnum((unsigned char)text[start-1]) || text[start-1] == '_'))
+    start--;
+  while(isalnum((unsigned char)text[end]) || text[end] == '_')
+    end++;
+  if(end == start || !isalpha((unsigned char)text[start]))
+    return 0;
+  return intern(&text[start], end - start);
+}
+
+
+/*
+ * Writes a range within a line into out.
+ */
+static void
+write_range(FILE *out, int line, int start, int end)
+{
+  fprintf(out, "{\"start\":{\"line\":%d,\"character\":%d},\"end\":{\"line\":%d,\"character\":%d}}",
+          line, start, line, end);
+}
+
+
+/*
+ * Writes the location of a label in line of doc into out.
+ * is_def is set for the location of its definition, see find_label.
+ */
+static void
+write_location(FILE *out, struct document *doc, struct line *line, int label, int is_def)
+{
+  const char *name = get_name(label);
+  int col = find_label(line->text, name, is_def);
+  fprintf(out, "{\"uri\":");
+  json_write_string(out, doc->uri);
+  fprintf(out, ",\"range\":");
+  if(col == -1)
+    write_range(out, line->ind, 0, strlen(line->text));
+  else
+    write_range(out, line->ind, col, col + strlen(name));
+  fprintf(out, "}");
+}
+
+
+/*
+ * Writes a publishDiagnostics notification with all diagnostics of doc into out,
+ * in order of the lines.
+ */
+static void
+write_diagnostics(FILE *out, struct document *doc)
+{
+  struct line *line;
+  int i, label, col, start, end;
+  if(doc->diagnosed.cnt > 0)
+    qsort(doc->diagnosed.lines, doc->diagnosed.cnt, sizeof(struct line *), compare_lines);
+  for(i=0; i<doc->diagnosed.cnt; i++)
+    doc->diagnosed.lines[i]->diag_ind = i;
+  fprintf(out, "{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/publishDiagnostics\","
+               "\"params\":{\"uri\":");
+  json_write_string(out, doc->uri);
+  fprintf(out, ",\"diagnostics\":[");
+  for(i=0; i<doc->diagnosed.cnt; i++) {
+    line = doc->diagnosed.lines[i];
+    label = line->diag_label;
+    if(label != 0 && -1 != (col = find_label(line->text, get_name(label),
+                                             label == line->stm.label))) {
+      start = col;
+      end = col + strlen(get_name(label));
+    } else if(label == 0 && line->error.errid != 0) {
+      get_error_range(line, &start, &end);
+    } else {
+      start = 0;
+      end = strlen(line->text);
+    }
+    fprintf(out, "%s{\"range\":", i == 0 ? "" : ",");
+    write_range(out, line->ind, start, end);
+    fprintf(out, ",\"severity\":%d,\"source\":\"assembler\",\"message\":\"",
+            line->diag > ___WARNINGS___ ? SEVERITY_WARNING : SEVERITY_ERROR);
+    line->error.errid = line->diag;  /* the message of any diagnostic is written alike */
+    write_errstr(out, line->error);
+    if(label != 0 || !IS_SYNTAX_ERR(line->diag))
+      line->error.errid = 0;
+    fprintf(out, "\"}");
+  }
+  fprintf(out, "]}}");
+}
+
+
+/*
+ * Writes the result of a definition request into out:
+ * the definitions of the label at the position of the request,
+ * or its .extern declarations if it isn't defined.
+ */
+static void
+write_definition(FILE *out, struct document *doc, Json_t *params)
+{
+  int label = label_at(doc, params), i, role;
+  struct line_set *set;
+  if(label == 0) {
+    fprintf(out, "null");
+    return;
+  }
+  role = get_label(doc, label)->sets[ROLE_DEF].cnt > 0 ? ROLE_DEF : ROLE_EXTERN;
+  set = &get_label(doc, label)->sets[role];
+  fprintf(out, "[");
+  for(i=0; i<set->cnt; i++) {
+    fprintf(out, i == 0 ? "" : ",");
+    write_location(out, doc, set->lines[i], label, role == ROLE_DEF);
+  }
+  fprintf(out, "]");
+}
+
+
+/*
+ * Writes the result of a references request into out: the operands,
+ * .entry and .extern declarations of the label at the position of the request,
+ * and its definitions if params.context.includeDeclaration is set.
+ */
+static void
+write_references(FILE *out, struct document *doc, Json_t *params)
+{
+  Json_t *decl = json_get(params, "context.includeDeclaration");
+  int label = label_at(doc, params), i, role, first = 1;
+  struct line_set *set;
+  fprintf(out, "[");
+  for(role=0; label != 0 && role<ROLES_CNT; role++) {
+    if(role == ROLE_DEF && (decl == NULL || decl->num == 0))
+      continue;
+    set = &get_label(doc, label)->sets[role];
+    for(i=0; i<set->cnt; i++) {
+      fprintf(out, first ? "" : ",");
+      write_location(out, doc, set->lines[i], label, role == ROLE_DEF);
+      first = 0;
+    }
+  }
+  fprintf(out, "]");
+}
+
+
+/*
+ * Reads the next message from in: its headers, and then its body.
+ * Returns the body, or NULL on end of input.
+ * A body longer than BODY_MAX (or than can be allocated) is skipped, and returned
+ * empty instead - so that it's answered as a message that can't be parsed.
+ * The returned body should be freed by the caller.
+ */
+static char*  /* the body */
+read_message(FILE *in)
+{
+  char header[HEADER_SIZE], *body;
+  long len = -1;
+  for(;;) {
+    if(NULL == fgets(header, HEADER_SIZE, in))
+      return NULL;
+    if(0 == strcmp(header, "\r\n") || 0 == strcmp(header, "\n"))
+      break;  /* end of headers */
+    if(0 == strncmp(header, CONTENT_LENGTH, strlen(CONTENT_LENGTH)))
+      len = strtol(&header[strlen(CONTENT_LENGTH)], NULL, 10);
+  }
+  if(len < 0)
+    return NULL;
+  if(len > BODY_MAX || NULL == (body = malloc(len + 1))) {
+    for(; len > 0 && EOF != fgetc(in); len--);
+    body = malloc(1);
+    body[0] = '\0';
+    return body;
+  }
+  if(len != fread(body, 1, len, in)) {
+    free(body);
+    return NULL;
+  }
+  body[len] = '\0';
+  return body;
+}
+
+
+/*
+ * Sends a message of len bytes into out, preceded by its header.
+ */
+static void
+send_message(FILE *out, const char *body, size_t len)
+{
+  fprintf(out, CONTENT_LENGTH" %lu\r\n\r\n", (unsigned long)len);
+  fwrite(body, 1, len, out);
+  fflush(out);
+}
+
+
+/*
+ * Writes the id of a request into out.
+ */
+static void
+write_id(FILE *out, Json_t *id)
+{
+  if(id == NULL)
+    fprintf(out, "null");
+  else if(id->type == JSON_STRING)
+    json_write_string(out, id->str);
+  else
+    fprintf(out, "%.0f", id->num);
+}
+
+
+/*
+ * Runs the language server: reads requests & notifications from in and writes
+ * responses & notifications into out, until an exit notification or the end of in.
+ * Returns 0 if the client shut the server down before exiting, else 1.
+ */
+int  /* nonzero on failure */
+run_lsp(FILE *in, FILE *out)
+{
+  Json_t *request, *method, *id, *params, *uri, *text, *change;
+  struct document *doc;
+  char *body, *buf;
+  size_t len;
+  FILE *msg;
+  int shutdown = 0;
+
+  init_interner();
+  while(NULL != (body = read_message(in))) {
+    request = json_parse(body);
+    free(body);
+    buf = NULL;
+    msg = open_memstream(&buf, &len);
+    if(request == NULL) {
+      fprintf(msg, "{\"jsonrpc\":\"2.0\",\"id\":null,\"error\":{\"code\":%d,"
+                   "\"message\":\"parse error\"}}", ERR_PARSE);
+      fclose(msg);
+      send_message(out, buf, len);
+      free(buf);
+      continue;
+    }
+    method = json_get(request, "method");
+    id = json_get(request, "id");
+    params = json_get(request, "params");
+    uri = json_get(params, "textDocument.uri");
+    doc = uri != NULL && uri->type == JSON_STRING ? find_document(uri->str) : NULL;
+    if(method == NULL || method->type != JSON_STRING) {
+      ;  /* a response, ignored */
+    } else if(0 == strcmp(method->str, "exit")) {
+      fclose(msg);
+      free(buf);
+      json_free(request);
+      break;
+    } else if(0 == strcmp(method->str, "textDocument/didOpen")) {
+      text = json_get(params, "textDocument.text");
+      if(uri != NULL && uri->type == JSON_STRING && text != NULL && text->type == JSON_STRING) {
+        if(doc != NULL)
+          close_document(doc);
+        open_document(uri->str, text->str);
+        write_diagnostics(msg, documents);
+      }
+    } else if(0 == strcmp(method->str, "textDocument/didChange")) {
+      if(doc != NULL) {
+        change = json_get(params, "contentChanges");
+        for(change = change != NULL ? change->child : NULL; change != NULL; change = change->next)
+          apply_change(doc, change);
+        write_diagnostics(msg, doc);
+      }
+    } else if(0 == strcmp(method->str, "textDocument/didClose")) {
+      if(doc != NULL) {
+        close_document(doc);
+        fprintf(msg, "{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/publishDiagnostics\","
+                     "\"params\":{\"uri\":");
+        json_write_string(msg, uri->str);
+        fprintf(msg, ",\"diagnostics\":[]}}");
+      }
+    } else if(id != NULL) {  /* a request */
+      fprintf(msg, "{\"jsonrpc\":\"2.0\",\"id\":");
+      write_id(msg, id);
+      if(0 == strcmp(method->str, "initialize")) {
+        fprintf(msg, ",\"result\":"CAPABILITIES);
+      } else if(0 == strcmp(method->str, "shutdown")) {
+        shutdown = 1;
+        fprintf(msg, ",\"result\":null");
+      } else if(0 == strcmp(method->str, "textDocument/definition")) {
+        fprintf(msg, ",\"result\":");
+        if(doc != NULL)
+          write_definition(msg, doc, params);
+        else
+          fprintf(msg, "null");
+      } else if(0 == strcmp(method->str, "textDocument/references")) {
+        fprintf(msg, ",\"result\":");
+        if(doc != NULL)
+          write_references(msg, doc, params);
+        else
+          fprintf(msg, "null");
+      } else {
+        fprintf(msg, ",\"error\":{\"code\":%d,\"message\":\"method not found\"}", ERR_NO_METHOD);
+      }
+      fprintf(msg, "}");
+    }
+    fclose(msg);
+    if(len > 0)
+      send_message(out, buf, len);
+    free(buf);
+    json_free(request);
+  }
+
+  while(documents != NULL)
+    close_document(documents);
+  cleanup_interner();
+  return !shutdown;
+}
@@ -0,0 +1,14 @@
+/* ===== lsp.h ============================================
+ * Header file for "lsp.c".
+ * Exposes run_lsp, the main loop of the language server.
+ */
+#ifndef LSP_H
+#define LSP_H
+
+
+#include <stdio.h>
+
+int run_lsp(FILE *in, FILE *out);
+
+
+#endif
@@ -0,0 +1,365 @@
+/* ===== optimize.c =======================================
+ * This module contains optional optimization passes over the array of statements
+ * that was produced by "parser.c".
+ * The passes run before "scan.c" assigns addresses to the statements, therefore
+ * rewriting or deleting statements is all that is needed - the label offsets are
+ * recomputed by write_memory_image as usual.
+ * A deleted statement is turned into a STATEMENT_IGNORE statement, just like a
+ * blank line, so line indices in later error messages remain intact.
+ *
+ * Peephole optimization:
+ *  Each entry of peephole_table inspects an operation statement together with
+ *  the operation statement that follows it and, if the pattern applies, rewrites
+ *  or deletes them. The table is applied repeatedly until no pattern applies.
+ *
+ * Jump threading:
+ *  A jmp/call/branch whose target label is defined on an unconditional "jmp Label"
+ *  (a trampoline) is retargeted to the final destination of the chain.
+ *  The trampolines themselves are kept, as other code may still fall into them.
+ *
+ * Dead code elimination:
+ *  The operation statements are split into basic blocks (see "flow.c"), and blocks
+ *  that can't be reached from the first operation or from an .entry label are deleted.
+ */
+
+/* ===== Includes ========================================= */
+#include <stdlib.h>
+#include <malloc.h>
+#include "optimize.h"
+#include "parser.h"
+#include "flow.h"
+#include "types.h"
+#include "consts.h"
+
+/* ===== CPP definitons =================================== */
+#define PEEPHOLE_CNT (sizeof(peephole_table) / sizeof(*peephole_table))
+
+/* ===== Declarations ===================================== */
+/* ----- prototypes --------------------------------------- */
+int peephole_optimize(Statement_t *statements);
+int thread_jumps(Statement_t *statements);
+int eliminate_dead_code(Statement_t *statements);
+
+static int find_thread_target(CodeLabel_t *table, int count, Statement_t *stm, long ic);
+static void mark_block(char *reachable, int *stack, int *top, int i);
+static Statement_t* next_op_stm(Statement_t *stm);
+static int delete_op_stm(Statement_t *stm, Statement_t *next);
+static int pp_nop_immed(Statement_t *stm, Statement_t *next);
+static int pp_nop_move(Statement_t *stm, Statement_t *next);
+static int pp_jump_next(Statement_t *stm, Statement_t *next);
+static int pp_mvhi_mvlo(Statement_t *stm, Statement_t *next);
+
+
+/* ===== Peephole table =================================== */
+/*
+ * Every pattern receives an operation statement and the operation statement
+ * following it (NULL if it is the last one), and returns 1 iff it modified them.
+ */
+static int (* const peephole_table[])(Statement_t *stm, Statement_t *next) = {
+  pp_nop_immed,   /* addi $x,0,$x   subi $x,0,$x   ori $x,0,$x      ->  (deleted) */
+  pp_nop_move,    /* move $x,$x     or $x,$x,$x    and $x,$x,$x     ->  (deleted) */
+  pp_jump_next,   /* bxx $a,$b,L / jmp L   immediately followed by L: ->  (deleted) */
+  pp_mvhi_mvlo    /* mvhi $a,$b  mvlo $a,$b  (or vice versa)        ->  move $a,$b */
+};
+
+
+/* ===== Code ============================================= */
+
+/*
+ * Returns the first operation statement after stm,
+ * or NULL if there are no more operation statements.
+ */
+static Statement_t*  /* the next operation statement */
+next_op_stm(Statement_t *stm)
+{
+  for(stm++; stm->type != STATEMENT_END; stm++) {
+    if(stm->type == STATEMENT_OPERATION)
+      return stm;
+  }
+  return NULL;
+}
+
+
+/*
+ * Deletes the operation statement stm.
+ * If stm defines a label, the label is moved onto next (the following operation
+ * statement) so that it keeps pointing at the same address.
+ * If the label can't be moved (next is missing or defines a label of its own),
+ * stm is left unmodified and 0 is returned.
+ */
+static int  /* 1 iff the statement was deleted */
+delete_op_stm(Statement_t *stm, Statement_t *next)
+{
+  if(stm->label != 0) {
+    if(next == NULL || next->label != 0)
+      return 0;
+    next->label = stm->label;
+    stm->label = 0;
+  }
+  free_statement(*stm);
+  stm->type = STATEMENT_IGNORE;
+  return 1;
+}
+
+
+/*
+ * Deletes arithmetic/logical I-type operations with a zero immediate
+ * whose source and destination registers are the same.
+ * e.g: addi $3,0,$3
+ */
+static int  /* 1 iff modified */
+pp_nop_immed(Statement_t *stm, Statement_t *next)
+{
+  struct ItypeOp Iop = stm->inst.op_inst.op.Iop;
+  switch(stm->inst.op_inst.opcode) {
+    case OP_ADDI:
+    case OP_SUBI:
+    case OP_ORI:
+      if(Iop.immed == 0 && Iop.rs == Iop.rt)
+        return delete_op_stm(stm, next);
+    default:
+      break;
+  }
+  return 0;
+}
+
+
+/*
+ * Deletes R-type operations that copy a register onto itself.
+ * e.g: move $3,$3  or  and $3,$3,$3
+ */
+static int  /* 1 iff modified */
+pp_nop_move(Statement_t *stm, Statement_t *next)
+{
+  struct RtypeOp Rop = stm->inst.op_inst.op.Rop;
+  switch(get_opid(stm->inst.op_inst)) {
+    case OP_MOVE:
+      if(Rop.rs == Rop.rd)
+        return delete_op_stm(stm, next);
+      break;
+    case OP_AND:
+    case OP_OR:
+      if(Rop.rs == Rop.rd && Rop.rt == Rop.rd)
+        return delete_op_stm(stm, next);
+    default:
+      break;
+  }
+  return 0;
+}
+
+
+/*
+ * Deletes branch operations and jmp operations whose target label
+ * is the label of the very next operation.
+ * e.g: beq $1,$2,Next
+ *      Next: stop
+ * NOTE: call operations are kept, as they also store the return address.
+ */
+static int  /* 1 iff modified */
+pp_jump_next(Statement_t *stm, Statement_t *next)
+{
+  int *labelp = get_target_label(&stm->inst.op_inst);
+  if(labelp == NULL || stm->inst.op_inst.opcode == OP_CALL)
+    return 0;
+  if(*labelp == 0 || next == NULL || *labelp != next->label)
+    return 0;
+  return delete_op_stm(stm, next);
+}
+
+
+/*
+ * Replaces a mvhi and mvlo pair operating on the same registers by a single move.
+ * mvhi/mvlo copy the high/low half of rs into the same half of rd, hence together
+ * they copy all of rs into rd.
+ * e.g: mvhi $1,$2
+ *      mvlo $1,$2   ->  move $1,$2
+ * The second operation must not define a label, since it is deleted.
+ */
+static int  /* 1 iff modified */
+pp_mvhi_mvlo(Statement_t *stm, Statement_t *next)
+{
+  enum OpId opid = get_opid(stm->inst.op_inst), next_opid;
+  struct RtypeOp Rop = stm->inst.op_inst.op.Rop, next_Rop;
+  if(next == NULL || next->label != 0)
+    return 0;
+  next_opid = get_opid(next->inst.op_inst);
+  next_Rop = next->inst.op_inst.op.Rop;
+  if(!(opid == OP_MVHI && next_opid == OP_MVLO)
+    && !(opid == OP_MVLO && next_opid == OP_MVHI))
+    return 0;
+  if(Rop.rs != next_Rop.rs || Rop.rd != next_Rop.rd)
+    return 0;
+
+  stm->inst.op_inst.op.Rop.funct = OP_MOVE >> FUNCT_SHIFT;
+  free_statement(*next);
+  next->type = STATEMENT_IGNORE;
+  return 1;
+}
+
+
+/*
+ * Applies the patterns of the peephole table to the operation statements,
+ * until none of them applies anymore.
+ * Returns the number of modifications performed.
+ */
+int  /* count of modifications */
+peephole_optimize(Statement_t *statements)
+{
+  Statement_t *stm;
+  int i, changed, total = 0;
+  do {
+    changed = 0;
+    for(stm = statements; stm->type != STATEMENT_END; stm++) {
+      if(stm->type != STATEMENT_OPERATION)
+        continue;
+      for(i=0; i < PEEPHOLE_CNT && stm->type == STATEMENT_OPERATION; i++)
+        changed += peephole_table[i](stm, next_op_stm(stm));
+    }
+    total += changed;
+  } while(changed);
+  return total;
+}
+
+
+/*
+ * Follows the chain of trampolines starting at the target label of
+ * the operation statement stm (whose IC is ic).
+ * Returns the label of the furthest destination stm may be retargeted to:
+ *  - For branches, a label defined in this file whose offset from ic
+ *    fits in the 16-bit immed field.
+ *  - For jmp/call, also a label declared external.
+ * Returns 0 if the target of stm shouldn't be changed.
+ */
+static int  /* the final destination */
+find_thread_target(CodeLabel_t *table, int count, Statement_t *stm, long ic)
+{
+  int target = 0;
+  CodeLabel_t *entry;
+  int *labelp = get_target_label(&stm->inst.op_inst);
+  int hops, is_branch = IS_BRANCH_OP(stm->inst.op_inst.opcode);
+
+  entry = search_label(table, count, *labelp);
+  /* a chain longer than the count of labels must be a loop of trampolines */
+  for(hops = 0; hops < count; hops++) {
+    if(entry == NULL || entry->stm == NULL)  /* not a trampoline */
+      break;
+    labelp = get_target_label(&entry->stm->inst.op_inst);
+    if(entry->stm->inst.op_inst.opcode != OP_JMP || labelp == NULL)
+      break;
+    entry = search_label(table, count, *labelp);
+    if(entry == NULL)  /* undefined label, reported when assembling the trampoline */
+      break;
+    if(is_branch && (entry->stm == NULL || !IN_BOUNDS(entry->ic - ic, 16)))
+      continue;  /* branches can't be retargeted to this label, try further along */
+    target = entry->name;
+  }
+  return hops < count ? target : 0;
+}
+
+
+/*
+ * Retargets jmp, call and branch operations whose target is a trampoline
+ * (an unconditional "jmp Label") to the final destination of the chain.
+ * Returns the number of retargeted operations.
+ */
+int  /* count of modifications */
+thread_jumps(Statement_t *statements)
+{
+  CodeLabel_t *table;
+  Statement_t *stm;
+  int *labelp, target;
+  long ic = 0;
+  int count, total = 0;
+
+  table = build_label_table(statements, &count);
+  for(stm = statements; stm->type != STATEMENT_END; stm++) {
+    if(stm->type != STATEMENT_OPERATION)
+      continue;
+    labelp = get_target_label(&stm->inst.op_inst);
+    if(labelp != NULL && *labelp != 0
+      && 0 != (target = find_thread_target(table, count, stm, ic))) {
+      *labelp = target;
+      total++;
+    }
+    ic += 4;
+  }
+  free(table);
+  return total;
+}
+
+
+/*
+ * Marks block i as reachable and pushes it onto the stack, unless
+ * it was already marked or i is BLOCK_NONE.
+ */
+static void
+mark_block(char *reachable, int *stack, int *top, int i)
+{
+  if(i == BLOCK_NONE || reachable[i])
+    return;
+  reachable[i] = 1;
+  stack[(*top)++] = i;
+}
+
+
+/*
+ * Deletes the operation statements of basic blocks that are unreachable.
+ * A block is reachable if it is the first block, starts at an .entry label, or is a
+ * successor of a reachable block. Since the target of jmp $reg is unknown, if any
+ * reachable block ends with one, all labelled blocks are considered reachable as well.
+ * Returns the count of bytes removed from the instruction image.
+ */
+int  /* count of bytes saved */
+eliminate_dead_code(Statement_t *statements)
+{
+  CodeLabel_t *labels, *label;
+  BasicBlock_t *blocks;
+  Statement_t *stm;
+  int label_cnt, count, i, top = 0, saved = 0;
+  int *stack;
+  char *reachable;
+
+  labels = build_label_table(statements, &label_cnt);
+  blocks = build_blocks(statements, labels, label_cnt, &count);
+  reachable = calloc(count + 1, sizeof(char));
+  stack = malloc((count + 1) * sizeof(int));
+
+  /* roots: the first block and blocks at .entry labels */
+  if(count > 0)
+    mark_block(reachable, stack, &top, 0);
+  for(stm = statements; stm->type != STATEMENT_END; stm++) {
+    if(stm->type == STATEMENT_DIRECTIVE && stm->inst.di_inst.dirid == DIR_ENTRY
+      && NULL != (label = search_label(labels, label_cnt, stm->inst.di_inst.dir.Sdir.label))
+      && label->stm != NULL)
+      mark_block(reachable, stack, &top, search_block(blocks, count, label->stm));
+  }
+  /* depth-first search */
+  while(top > 0) {
+    i = stack[--top];
+    if(blocks[i].last->inst.op_inst.opcode == OP_JMP && blocks[i].last->inst.op_inst.op.Jop.reg) {
+      for(i=0; i<count; i++)  /* jmp $reg - any labelled block may be its target */
+        if(blocks[i].first->label != 0)
+          mark_block(reachable, stack, &top, i);
+      continue;
+    }
+    mark_block(reachable, stack, &top, blocks[i].next);
+    mark_block(reachable, stack, &top, blocks[i].target);
+  }
+
+  for(i=0; i<count; i++) {
+    if(reachable[i])
+      continue;
+    for(stm = blocks[i].first; stm <= blocks[i].last; stm++) {
+      if(stm->type != STATEMENT_OPERATION)
+        continue;
+      free_statement(*stm);
+      stm->type = STATEMENT_IGNORE;
+      saved += 4;
+    }
+  }
+  free(reachable);
+  free(stack);
+  free(blocks);
+  free(labels);
+  return saved;
+}
@@ -0,0 +1,16 @@
+/* ===== optimize.h =======================================
+ * Header file for "optimize.c".
+ * Exposes the optimization passes that operate on the parsed statement array.
+ */
+#ifndef OPTIMIZE_H
+#define OPTIMIZE_H
+
+
+#include "types.h"
+
+int peephole_optimize(Statement_t *statements);
+int thread_jumps(Statement_t *statements);
+int eliminate_dead_code(Statement_t *statements);
+
+
+#endif
@@ -0,0 +1,471 @@
+/* ===== output.c =========================================
+ * This module writes the assembled program (the instruction & memory images
+ * and the symbol table) in the output formats of the language specifications:
+ * - The '.ob' object file, containing the combined instruction and memory image.
+ * - The '.ent' entries file, listing the addresses of symbols declared entries.
+ * - The '.ext' externals file, listing the addresses referencing external symbols.
+ * Each format is rendered into a stream by write_ob/write_ent/write_ext, which
+ * are used both for writing the output files next to the source file and for
+ * streaming the outputs to stdout (see write_stream).
+ * With --format, the object file is written in another format instead of '.ob',
+ * for loaders and flashing tools (see set_ob_format):
+ * - '.bin' - a flat binary image: the instruction image followed by the memory image,
+ *            whose first byte is loaded at address INITIAL_IC.
+ * - '.hex' - the same image as Intel HEX records (at addresses from INITIAL_IC).
+ * Both are written straight from the images, in chunks (zero runs of the memory
+ * image are never expanded into it, see get_mem_chunk).
+ * With --if-changed, each output file is rendered in memory first, and only
+ * replaced (atomically, by renaming a temporary file over it) if its contents changed,
+ * so that the modification times of unchanged outputs are kept.
+ */
+
+/* ===== Includes ========================================= */
+#define _POSIX_C_SOURCE 200809L  /* open_memstream */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "output.h"
+#include "tables.h"
+#include "intern.h"
+#include "scan.h"
+#include "probes.h"
+#include "consts.h"
+
+/* ===== CPP definitons =================================== */
+/* framing of the sections of a framed stream, see write_stream */
+#define FRAME_FILE    "#file %s\n"
+#define FRAME_SECTION "#section %s\n"
+#define FRAME_END     "#end\n"
+#define TEMP_PATH     "%s.%ld.tmp"  /* temporary file an output is written to, see replace_file */
+#define CMP_CHUNK     4096          /* size of the chunks an existing output is compared in */
+#define ZERO_CHUNK    4096          /* size of the chunks zero runs are written in, see write_bin */
+#define HEX_DATA_LEN  16            /* count of data bytes in an Intel HEX data record */
+#define HEX_LINE_MAX  (11 + 2*HEX_DATA_LEN + 1)  /* length of the longest record line */
+#define HEX_CHUNK     4096          /* size of the buffer the records are rendered into */
+/* Intel HEX record types */
+#define HEX_DATA      0x00
+#define HEX_EOF       0x01
+#define HEX_EXT_ADDR  0x04  /* extended linear address: upper 16 bits of the next addresses */
+
+/* ===== Declarations ===================================== */
+/* defined in "assembler.c" */
+extern char *filename, *filepath;
+extern long ICF, DCF;
+extern char *inst_img;
+extern long options;
+char* get_output_path(const char *ext);
+
+/* defined in "tables.c" */
+extern SymbolEntry_t *symtable;
+extern int symtable_size;
+
+/* ----- prototypes --------------------------------------- */
+char get_img_byte(long n);
+int write_ob(FILE *out);
+int write_bin(FILE *out);
+int write_hex(FILE *out);
+int write_ent(FILE *out);
+int write_ext(FILE *out);
+int set_ob_format(const char *name);
+void write_ob_file();
+void write_ent_file();
+void write_ext_file();
+void write_stream(FILE *out, int framed);
+
+static void read_img(long n, char *buf, long len);
+static char* put_hex_record(char *line, int type, long addr, const char *data, int len);
+static int is_unchanged(const char *path, const char *data, size_t len);
+static void replace_file(const char *path, const char *data, size_t len);
+static void write_file(const char *ext, int (*writer)(FILE *out));
+
+/* the formats of the object file, see set_ob_format */
+static struct {
+  char *name;                 /* value of the --format option */
+  char *ext;                  /* extension of the object file */
+  int (*writer)(FILE *out);   /* writes the object file contents */
+} ob_formats[] = {
+  {"ob",  ".ob",  write_ob},
+  {"bin", ".bin", write_bin},
+  {"hex", ".hex", write_hex}
+};
+static int ob_format;  /* index of the format of the object file in ob_formats */
+
+
+/* ===== Code ============================================= */
+
+/*
+ * Returns the nth byte in the combined image of instructions and memory.
+ */
+char  /* the byte */
+get_img_byte(long n) {
+  if(n < ICF) {
+    return inst_img[n];
+  }
+  return get_mem_byte(n-ICF);
+}
+
+
+/*
+ * Writes the object file contents into out, according to the langauage specifications.
+ * Returns the count of bytes of the images.
+ */
+int  /* count of bytes */
+write_ob(FILE *out)
+{
+  long i;
+  /* header line */
+  fprintf(out, "     %lu %lu\n%04d ", ICF, DCF, INITIAL_IC);
+  /* bytes */
+  for(i=0; i < DCF + ICF - 1; i++) {
+    fprintf(out, "%02X", get_img_byte(i) & 0xFF);
+    if(i % 4 == 3) /* 4th and last byte in line */
+      fprintf(out, "\n%04ld ", i+INITIAL_IC+1);
+    else fprintf(out, " ");
+  }
+  fprintf(out, "%02X\n", get_img_byte(ICF+DCF-1) & 0xFF);
+  return ICF + DCF;
+}
+
+
+/*
+ * Copies len bytes of the combined image of instructions and memory, from its nth byte, into buf.
+ */
+static void
+read_img(long n, char *buf, long len)
+{
+  const char *chunk;
+  long cnt;
+  while(len > 0) {
+    if(n < ICF) {
+      cnt = ICF - n < len ? ICF - n : len;
+      memcpy(buf, &inst_img[n], cnt);
+    } else {
+      cnt = get_mem_chunk(n - ICF, &chunk);
+      if(cnt > len)
+        cnt = len;
+      if(chunk != NULL)
+        memcpy(buf, chunk, cnt);
+      else
+        memset(buf, 0, cnt);
+    }
+    n += cnt;
+    buf += cnt;
+    len -= cnt;
+  }
+}
+
+
+/*
+ * Writes the flat binary image into out: the instruction image followed by the memory image.
+ * Returns the count of bytes of the images.
+ */
+int  /* count of bytes */
+write_bin(FILE *out)
+{
+  static const char zeros[ZERO_CHUNK];
+  const char *chunk;
+  long offset, len;
+  fwrite(inst_img, 1, ICF, out);
+  for(offset = 0; offset < DCF; offset += len) {
+    len = get_mem_chunk(offset, &chunk);
+    if(chunk != NULL)
+      fwrite(chunk, 1, len, out);
+    else {  /* a zero run */
+      if(len > ZERO_CHUNK)
+        len = ZERO_CHUNK;
+      fwrite(zeros, 1, len, out);
+    }
+  }
+  return ICF + DCF;
+}
+
+
+/*
+ * Renders an Intel HEX record of the given type, address (the lower 16 bits) and
+ * len bytes of data into line, as ":LLAAAATT<data>CC\n" (CC is the checksum).
+ * Returns a pointer past the end of the rendered line (which isn't null-terminated).
+ */
+static char*  /* end of the line */
+put_hex_record(char *line, int type, long addr, const char *data, int len)
+{
+  static const char digits[] = "0123456789ABCDEF";
+  unsigned char bytes[4 + HEX_DATA_LEN], sum = 0;
+  int i;
+  bytes[0] = len;
+  bytes[1] = (addr >> 8) & 0xFF;
+  bytes[2] = addr & 0xFF;
+  bytes[3] = type;
+  if(len > 0)  /* the data of the end of file record is NULL */
+    memcpy(&bytes[4], data, len);
+  *line++ = ':';
+  for(i=0; i < 4 + len; i++) {
+    sum += bytes[i];
+    *line++ = digits[bytes[i] >> 4];
+    *line++ = digits[bytes[i] & 0xF];
+  }
+  sum = -sum;  /* the bytes of the record sum up to 0 */
+  *line++ = digits[sum >> 4];
+  *line++ = digits[sum & 0xF];
+  *line++ = '\n';
+  return line;
+}
+
+
+/*
+ * Writes the image into out as Intel HEX records, at addresses starting at INITIAL_IC:
+ * data records of HEX_DATA_LEN bytes (which don't cross a 64KB boundary), preceded by
+ * an extended linear address record whenever the upper 16 bits of the address change,
+ * and an end of file record.
+ * Returns the count of bytes of the images.
+ */
+int  /* count of bytes */
+write_hex(FILE *out)
+{
+  char lines[HEX_CHUNK], *line = lines, data[HEX_DATA_LEN];
+  long n, addr, len, high = 0, total = ICF + DCF;
+  for(n=0; n < total; n += len) {
+    if(line - lines > HEX_CHUNK - 2*HEX_LINE_MAX) {  /* no room for the next records */
+      fwrite(lines, 1, line - lines, out);
+      line = lines;
+    }
+    addr = n + INITIAL_IC;
+    if(addr >> 16 != high) {
+      high = addr >> 16;
+      data[0] = (high >> 8) & 0xFF;
+      data[1] = high & 0xFF;
+      line = put_hex_record(line, HEX_EXT_ADDR, 0, data, 2);
+    }
+    len = total - n < HEX_DATA_LEN ? total - n : HEX_DATA_LEN;
+    if((addr & 0xFFFF) + len > 0x10000)
+      len = 0x10000 - (addr & 0xFFFF);
+    read_img(n, data, len);
+    line = put_hex_record(line, HEX_DATA, addr, data, len);
+  }
+  line = put_hex_record(line, HEX_EOF, 0, NULL, 0);
+  fwrite(lines, 1, line - lines, out);
+  return total;
+}
+
+
+/*
+ * Writes the externals file contents into out, according to the langauage specifications.
+ * If out is NULL, nothing is written.
+ * Returns the count of lines (references to external symbols).
+ */
+int  /* count of lines */
+write_ext(FILE *out)
+{
+  SymbolEntry_t symbol;
+  int i, count = 0;
+  for(i=0; i<symtable_size; i++) {
+    symbol = symtable[i];
+    if((symbol.attr & SYM_REQUIRED) && (symbol.attr & SYM_EXTERN)) {
+      count++;
+      if(out != NULL)
+        fprintf(out, "%s %04ld\n", get_name(symbol.name),
+            symbol.offset + INITIAL_IC + (symbol.attr & SYM_DATA ? ICF : 0)
+        );
+    }
+  }
+  return count;
+}
+
+
+/*
+ * Writes the entries file contents into out, according to the langauage specifications.
+ * If out is NULL, nothing is written.
+ * Returns the count of lines (symbols declared entries).
+ */
+int  /* count of lines */
+write_ent(FILE *out)
+{
+  SymbolEntry_t symbol;
+  int i, count = 0;
+  for(i=0; i<symtable_size; i++) {
+    symbol = symtable[i];
+    if((symbol.attr & SYM_ENTRY) && !(symbol.attr & SYM_REQUIRED)) {
+      count++;
+      if(out != NULL)
+        fprintf(out, "%s %04ld\n", get_name(symbol.name),
+            symbol.offset + INITIAL_IC + (symbol.attr & SYM_DATA ? ICF : 0)
+        );
+    }
+  }
+  return count;
+}
+
+
+/*
+ * Determines whether the file at path consists of exactly the len bytes of data.
+ */
+static int  /* 1 iff unchanged */
+is_unchanged(const char *path, const char *data, size_t len)
+{
+  char chunk[CMP_CHUNK];
+  struct stat st;
+  size_t offset = 0, n;
+  FILE *file;
+  if(0 != stat(path, &st) || st.st_size != len)
+    return 0;
+  if(NULL == (file = fopen(path, "r")))
+    return 0;
+  while(offset < len && 0 != (n = fread(chunk, 1, CMP_CHUNK, file))) {
+    if(n > len - offset || 0 != memcmp(chunk, &data[offset], n))
+      break;
+    offset += n;
+  }
+  fclose(file);
+  return offset == len;
+}
+
+
+/*
+ * Replaces the file at path with the len bytes of data, atomically:
+ * the data is written into a temporary file next to it, which is then renamed over it.
+ */
+static void
+replace_file(const char *path, const char *data, size_t len)
+{
+  char *temppath = malloc(strlen(path) + strlen(TEMP_PATH) + 3*sizeof(long));
+  FILE *file;
+  int written;
+  sprintf(temppath, TEMP_PATH, path, (long)getpid());
+  if(NULL != (file = fopen(temppath, "w"))) {
+    written = len == fwrite(data, 1, len, file);
+    if(0 == fclose(file) && written)  /* closed even if the write failed */
+      rename(temppath, path);
+    else
+      remove(temppath);
+  }
+  free(temppath);
+}
+
+
+/*
+ * Writes the output file of the current source file with extension ext,
+ * whose contents are written by writer.
+ * With --if-changed, the contents are rendered in memory, and the file
+ * is only replaced if they differ from its current contents.
+ */
+static void
+write_file(const char *ext, int (*writer)(FILE *out))
+{
+  char *path = get_output_path(ext), *data = NULL;
+  size_t len = 0;
+  FILE *file;
+  PROBE2(phase__start, ext, filename);
+  if(!(options & OPT_IF_CHANGED)) {
+    if(NULL != (file = fopen(path, "w"))) {
+      writer(file);
+      PROBE3(phase__done, ext, filename, ftell(file));
+      fclose(file);
+    }
+    free(path);
+    return;
+  }
+  if(NULL != (file = open_memstream(&data, &len))) {
+    writer(file);
+    fclose(file);
+    PROBE3(phase__done, ext, filename, len);
+    if(!is_unchanged(path, data, len))
+      replace_file(path, data, len);
+  }
+  free(data);
+  free(path);
+}
+
+
+/*
+ * Sets the format of the object file, by its name ("ob", "bin" or "hex"; see --format).
+ * Returns -1 if there's no format by that name, else 0.
+ */
+int  /* nonzero on failure */
+set_ob_format(const char *name)
+{
+  int i;
+  for(i=0; i < sizeof(ob_formats) / sizeof(*ob_formats); i++) {
+    if(0 == strcmp(name, ob_formats[i].name)) {
+      ob_format = i;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+
+/*
+ * Writes the object file, in the format set by set_ob_format
+ * (the .ob file according to the langauage specifications by default).
+ */
+void
+write_ob_file()
+{
+  write_file(ob_formats[ob_format].ext, ob_formats[ob_format].writer);
+}
+
+
+/*
+ * If applicable, Writes the .ext file according to the langauage specifications.
+ */
+void
+write_ext_file()
+{
+  if(0 == write_ext(NULL))  /* only create file if relevant */
+    return;
+  write_file(".ext", write_ext);
+}
+
+
+/*
+ * If applicable, Writes the .ent file according to the langauage specifications.
+ */
+void
+write_ent_file()
+{
+  if(0 == write_ent(NULL))  /* only create file if relevant */
+    return;
+  write_file(".ent", write_ent);
+}
+
+
+/*
+ * Streams the outputs into out (typically stdout) instead of writing files.
+ * If framed is 0, only the object file contents are written.
+ * Else all relevant outputs are written as one framed stream:
+ *    #file <source file name>
+ *    #section .ob            (or the extension of the format set by set_ob_format)
+ *    <object file contents>
+ *    #section .ent           (only if there are entries)
+ *    <entries file contents>
+ *    #section .ext           (only if there are external references)
+ *    <externals file contents>
+ *    #end
+ * No line of the outputs themselves starts with '#'.
+ */
+void
+write_stream(FILE *out, int framed)
+{
+  PROBE2(phase__start, "stdout", filename);
+  if(!framed) {
+    ob_formats[ob_format].writer(out);
+    fflush(out);
+    PROBE3(phase__done, "stdout", filename, ICF + DCF);
+    return;
+  }
+  fprintf(out, FRAME_FILE, filename);
+  fprintf(out, FRAME_SECTION, ob_formats[ob_format].ext);
+  ob_formats[ob_format].writer(out);
+  if(write_ent(NULL) > 0) {
+    fprintf(out, FRAME_SECTION, ".ent");
+    write_ent(out);
+  }
+  if(write_ext(NULL) > 0) {
+    fprintf(out, FRAME_SECTION, ".ext");
+    write_ext(out);
+  }
+  fprintf(out, FRAME_END);
+  fflush(out);
+  PROBE3(phase__done, "stdout", filename, ICF + DCF);
+}
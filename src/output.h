@@ -0,0 +1,26 @@
+/* ===== output.h =========================================
+ * Header file for "output.c".
+ * Exposes the writers of the '.ob', '.ent' and '.ext' outputs (and of the '.bin' and
+ * '.hex' formats of the object file, see set_ob_format),
+ * both into files next to the source file and into a stream.
+ */
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+
+#include <stdio.h>
+
+char get_img_byte(long n);
+int write_ob(FILE *out);
+int write_bin(FILE *out);
+int write_hex(FILE *out);
+int write_ent(FILE *out);
+int write_ext(FILE *out);
+int set_ob_format(const char *name);
+void write_ob_file();
+void write_ent_file();
+void write_ext_file();
+void write_stream(FILE *out, int framed);
+
+
+#endif
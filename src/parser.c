@@ -17,21 +17,73 @@
 #include "parser.h"
 #include "tokenizer.h"
 #include "tables.h"
+#include "intern.h"
 #include "errors.h"
+#include "probes.h"
 #include "types.h"
 #include "consts.h"
 
-/* ===== CPP Definitions ================================== */
-/* evaluates to 1 iff x is in bounds of signed int with n bits */
-#define IN_BOUNDS(x,n) ((~0 << ((n)-1) <= (x)) && ((x) <= ~(~0 << ((n)-1))))
+/* ===== CPP definitons =================================== */
+#define MAX_MACRO_PARAMS 16
+/* longest expansion of li: seed, 16 doublings, offset and complement, see expand_li */
+#define MAX_LI_LEN 19
+/* bounds of an immediate added by a single operation: addi, or subi for 32768 */
+#define LI_IN_BOUNDS(x) (-32768 <= (x) && (x) <= 32768)
+/* flags of the start of a line */
+#define LINE_FLAGS  (EXP_LABELDEF |  /* line may start with a label definiton */ \
+                     EXP_COMMENT  |  /* line may be a comment */ \
+                     EXP_END      |  /* line may be empty */ \
+                     EXP_OP       |  /* line may start with an operation */ \
+                     EXP_DIR)        /* line may start with a directive */
 
 /* ===== Declarations ===================================== */
 static Error_t error;   /* errno for statement errors */
 extern int error_occurred;  /* defined in "errors.c" */
+extern char *filename;      /* defined in "assembler.c" */
+
+/* ----- macros ------------------------------------------- */
+/* a line of the body of a macro, tokenized once into a template (see add_macro_line) */
+struct template_line {
+  char *text;       /* the line, for diagnostics                              */
+  int line_ind;     /* index of the line in the source file                   */
+  Token_t *toks;    /* the tokens of the line, up to and including TOK_END    */
+  int *params;      /* index of the parameter substituted into each token, or -1 */
+  int toks_cnt;
+};
+
+struct macro {
+  char *name;       /* empty if the macro can't be called (invalid definition) */
+  char *params[MAX_MACRO_PARAMS];  /* names of the parameters, without PARAM_CHAR */
+  int params_cnt;
+  struct template_line *lines;     /* the body */
+  int lines_cnt, lines_max;
+  int line_ind;     /* index of the .macro line */
+};
+
+static struct macro *macros;  /* the macros defined so far in the file */
+static int macros_cnt, macros_max;
+static int defining = -1;     /* index of the macro being defined, or -1 */
+static int source_line;       /* index of the last line read from the file */
+
+/* ----- li pseudo-operation ------------------------------ */
+static Statement_t li_seq[MAX_LI_LEN];  /* the expansion of the last li, see expand_li */
+static int li_cnt, li_next;             /* its length, and the index of its next statement */
+
+/* the macro call being expanded */
+static struct {
+  struct macro *macro;              /* NULL if none */
+  Token_t args[MAX_MACRO_PARAMS];   /* the arguments of the call */
+  int argc;
+  int next;                         /* index of the next line of the body to instantiate */
+  int label;                        /* label of the call, taken by the first statement, or 0 */
+  char *line;                       /* the line of the call, errors are reported at */
+} expansion;
 
 /* ----- prototypes --------------------------------------- */
 Statement_t* parse_file(FILE *file);
-static void free_statement(Statement_t stm);
+int parse_next_statement(FILE *file, Statement_t *stm, int line_ind, int report);
+int parse_statement(const char *line, Statement_t *stm, Error_t *err);
+void free_statement(Statement_t stm);
 static int parse_token   (Token_t tok, Statement_t *stm, long *flags);
 static int parse_op      (Token_t tok, Statement_t *stm, long *flags);
 static int parse_dir     (Token_t tok, Statement_t *stm, long *flags);
@@ -40,8 +92,24 @@ static int parse_label   (Token_t tok, Statement_t *stm, long *flags);
 static int parse_reg     (Token_t tok, Statement_t *stm, long *flags);
 static int parse_immed   (Token_t tok, Statement_t *stm, long *flags);
 static int parse_string  (Token_t tok, Statement_t *stm, long *flags);
+static int parse_array   (Statement_t *stm);
 static int parse_line(char *line, Statement_t *statement);
+static int parse_source_line(char *line, Statement_t *stm);
+static int define_macro(char *rest, char *line);
+static void add_macro_line(struct macro *macro, char *line);
+static int call_macro(struct macro *macro, char *labeldef, char *rest, char *line,
+                      Statement_t *stm);
+static int expand_next(Statement_t *stm);
+static int instantiate_line(struct template_line *tl, Statement_t *stm);
+static void end_expansion();
+static void reset_macros();
+static int search_macro(const char *name, size_t len);
+static int is_macro_name(char *name);
+static char* next_macro_item(char **rest);
+static int macro_error(enum ErrId errid, const char *line, int macro_line);
 static int immed_in_bounds(Statement_t stm, long immed);
+static void expand_li(Statement_t *stm);
+static void li_operation(Statement_t *stm, enum OpId opid, int rs, long immed, int rt);
 
 /* ===== Code ============================================= */
 
@@ -75,6 +143,9 @@ parse_op(Token_t tok, Statement_t *stm, long *flags)
     case OP_STOP:
       *flags = EXP_END;
       break;
+    case OP_LI:
+      *flags = EXP_REG;
+      break;
     default:
       *flags = EXP_REG | REG_RS;
   }
@@ -101,13 +172,14 @@ parse_dir(Token_t tok, Statement_t *stm, long *flags)
 
   switch(dirid) {
     case DIR_ASCIZ:
+    case DIR_INCBIN:
       *flags = EXP_STRING;
       break;
     case DIR_ENTRY:
     case DIR_EXTERN:
       *flags = EXP_LABEL;
       break;
-    default:  /* .dh, .dw or .db*/
+    default:  /* .dh, .dw, .db, .align, .space or .fill */
       *flags = EXP_IMMED;
   };
   return 0;
@@ -119,22 +191,23 @@ parse_dir(Token_t tok, Statement_t *stm, long *flags)
  * Sets the statement label.
  * If the label name is a reserved keyword returns EINVAL_LABEL.
  * If the label name is longer than MAX_LABEL_LEN, returns ELONG_LABEL.
- * Else 0 to indicate no erros.
+ * Else 0 to indicate no erros. Local labels are never reserved, nor too long.
  */
 static int  /* always 0 */
 parse_labeldef(Token_t tok, Statement_t *stm, long *flags)
 {
-  char** labelp = &stm->label;
-  if(  -1 != search_op(tok.value.label)
-    || -1 != search_dir(tok.value.label)) {
-    free(tok.value.label);
-    return EINVAL_LABEL;
-  }
-  if(strlen(tok.value.label) > MAX_LABEL_LEN) {
-    free(tok.value.label);
-    return ELONG_LABEL;
+  char *name;
+  if(!IS_LOCAL_LABEL(tok.value.label)) {  /* local labels are numbers - never reserved */
+    name = (char *)get_name(tok.value.label);
+    if(  -1 != search_op(name)
+      || -1 != search_dir(name)) {
+      return EINVAL_LABEL;
+    }
+    if(strlen(name) > MAX_LABEL_LEN) {
+      return ELONG_LABEL;
+    }
   }
-  *labelp = tok.value.label;
+  stm->label = tok.value.label;
   *flags = EXP_OP | EXP_DIR;
   return 0;
 }
@@ -142,16 +215,22 @@ parse_labeldef(Token_t tok, Statement_t *stm, long *flags)
 
 /*
  * Parses tok as a label token and updates stm and flags accordingly.
- * Sets the Iop/Jop instruction label.
- * Always returns 0 to indicate no erros.
+ * Sets the Iop/Jop instruction label, or the .entry/.extern directive label.
+ * If a local label is declared entry or external, returns ELOCAL_LABEL_DECL,
+ * else 0 to indicate no erros.
  */
-static int  /* always 0 */
+static int  /* nonzero on failure */
 parse_label(Token_t tok, Statement_t *stm, long *flags)
 {
-  char **labelp;
-  labelp = OPCODE_TO_OPTYPE(stm->inst.op_inst.opcode) == OPTYPE_I ?
-           &stm->inst.op_inst.op.Iop.label :  /* branch op */
-           &stm->inst.op_inst.op.Jop.label;
+  int *labelp;
+  if(stm->type == STATEMENT_DIRECTIVE && IS_LOCAL_LABEL(tok.value.label))
+    return ELOCAL_LABEL_DECL;
+  if(stm->type == STATEMENT_DIRECTIVE)
+    labelp = &stm->inst.di_inst.dir.Sdir.label;
+  else
+    labelp = OPCODE_TO_OPTYPE(stm->inst.op_inst.opcode) == OPTYPE_I ?
+             &stm->inst.op_inst.op.Iop.label :  /* branch op */
+             &stm->inst.op_inst.op.Jop.label;
   *labelp = tok.value.label;
   *flags = EXP_END;
   return 0;
@@ -165,6 +244,7 @@ parse_label(Token_t tok, Statement_t *stm, long *flags)
  *    sets the appropriate register field according to the set flag (REG_RS, REG_RD or REG_RT)
  *  J-type:
  *    sets the reg field to 1 and the addr field to the regiser id.
+ *    for the li pseudo-operation: sets the reg field to the register id.
  * If the register id is not a valid register, returns EINVAL_REG,
  * else returns 0 to indicate no erros.
  */
@@ -183,6 +263,10 @@ parse_reg(Token_t tok, Statement_t *stm, long *flags)
     op_inst->op.Jop.addr = reg;
     *flags = EXP_END;
   }
+  else if (op_inst->opcode == OP_LI) {
+    op_inst->op.Jop.reg = reg;
+    *flags = EXP_IMMED;
+  }
   /* R-type operation */
   else if(OPCODE_TO_OPTYPE(op_inst->opcode) == OPTYPE_R) {
     if(*flags & REG_RS) {  /* rs register */
@@ -231,24 +315,66 @@ parse_reg(Token_t tok, Statement_t *stm, long *flags)
  * Parses tok as an immediate token and updates stm and flags accordingly.
  * If the currently parsed instruction is of type:
  *  Operation:
- *    sets the Iop immed field to the token's immediate.
+ *    sets the Iop immed field to the token's immediate,
+ *    or the Jop addr field for the li pseudo-operation (a 32-bit immediate).
  *  Directive:
  *    appends the token's immediate to the argument array of the directive.
  * If the immediate is out of bounds for a 16-bit signed integer, returns EINVAL_IMMED,
- * else returns 0 to indicate no erros.
+ * if it is the argument of a .align directive but isn't a positive power of 2,
+ * returns EINVAL_ALIGN, else returns 0 to indicate no erros.
+ * The offset and length arguments of a .incbin directive must not be negative,
+ * and neither must the argument of .space or the count argument of .fill.
+ * The size argument of .fill must be 1, 2 or 4 (else EINVAL_FILL_SIZE is returned),
+ * and its value argument must be within bounds for that size.
  */
 static int  /* nonzero on failure */
 parse_immed(Token_t tok, Statement_t *stm, long *flags)
 {
   struct AtypeDir *Adir = &(stm->inst.di_inst.dir.Adir);
+  struct NtypeDir *Ndir = &(stm->inst.di_inst.dir.Ndir);
   int size=0, i;
   int immed = tok.value.immed;
   if(0 == (size = immed_in_bounds(*stm, immed)))
     return EINVAL_IMMED;
   /* determine which operand corresponds to the register */
-  if (stm->type == STATEMENT_OPERATION) {
+  if (stm->type == STATEMENT_OPERATION && stm->inst.op_inst.opcode == OP_LI) {
+    if(!IN_BOUNDS(tok.value.immed, 32))  /* not truncated, as it's 32-bit */
+      return EINVAL_IMMED;
+    stm->inst.op_inst.op.Jop.addr = immed;
+    *flags = EXP_END;
+  } else if (stm->type == STATEMENT_OPERATION) {
     stm->inst.op_inst.op.Iop.immed = immed;
     *flags = EXP_REG | REG_RT;
+  } else if (stm->inst.di_inst.dirid == DIR_ALIGN) {
+    if(immed <= 0 || (immed & (immed - 1)) != 0) {
+      return EINVAL_ALIGN;
+    }
+    Ndir->argv[Ndir->argc++] = immed;
+    *flags = EXP_END;
+  } else if (stm->inst.di_inst.dirid == DIR_SPACE) {
+    if(immed < 0) {
+      return EINVAL_IMMED;
+    }
+    Ndir->argv[Ndir->argc++] = immed;
+    *flags = EXP_END;
+  } else if (stm->inst.di_inst.dirid == DIR_FILL) {
+    if(Ndir->argc == 0 && immed < 0) {
+      return EINVAL_IMMED;
+    }
+    if(Ndir->argc == 1 && immed != 1 && immed != 2 && immed != 4) {
+      return EINVAL_FILL_SIZE;
+    }
+    if(Ndir->argc == 2 && !IN_BOUNDS(immed, Ndir->argv[1]*8)) {
+      return EINVAL_IMMED;
+    }
+    Ndir->argv[Ndir->argc++] = immed;
+    *flags = Ndir->argc < 3 ? EXP_IMMED : EXP_END;
+  } else if (stm->inst.di_inst.dirid == DIR_INCBIN) {
+    if(immed < 0) {
+      return EINVAL_IMMED;
+    }
+    stm->inst.di_inst.dir.Bdir.argv[stm->inst.di_inst.dir.Bdir.argc++] = immed;
+    *flags = stm->inst.di_inst.dir.Bdir.argc == 1 ? EXP_IMMED : EXP_END;
   } else {
     if(!IN_BOUNDS(immed, size*8)) {
       return EINVAL_IMMED;
@@ -264,6 +390,33 @@ parse_immed(Token_t tok, Statement_t *stm, long *flags)
 }
 
 
+/*
+ * Parses all the immediates of an array directive (.db, .dh, .dw) at once,
+ * and sets the directive's argument array - sized once, instead of growing it
+ * by each immediate as parse_immed does.
+ * Returns -1 if the immediates can't be parsed in bulk (see next_immed_array),
+ * in which case they are left to be parsed one token at a time, else 0.
+ */
+static int  /* nonzero on failure */
+parse_array(Statement_t *stm)
+{
+  struct AtypeDir *Adir = &(stm->inst.di_inst.dir.Adir);
+  enum DirId dirid = stm->inst.di_inst.dirid;
+  int values[MAX_LINE_LEN];  /* a line can't hold more immediates */
+  int size = immed_in_bounds(*stm, 0);  /* size of an immediate */
+  int count, i;
+  if(dirid != DIR_DB && dirid != DIR_DH && dirid != DIR_DW)
+    return -1;
+  if(-1 == (count = next_immed_array(values, MAX_LINE_LEN, size*8)))
+    return -1;
+  Adir->argv = malloc(count * size);
+  for(i=0; i<count; i++)
+    memcpy((char *)Adir->argv + i*size, &values[i], size);
+  Adir->argc = count;
+  return 0;
+}
+
+
 /*
  * Determines whether the immediate value is within bounds
  * given the context of the current statement.
@@ -287,6 +440,7 @@ immed_in_bounds(Statement_t stm, long immed)
         size = 2; break;
       case OP_LW:
       case OP_SW:
+      case OP_LI:
         size = 4; break;
       default: break;
     }
@@ -295,6 +449,9 @@ immed_in_bounds(Statement_t stm, long immed)
       case DIR_DB: size = 1; break;
       case DIR_DH: size = 2; break;
       case DIR_DW: size = 4; break;
+      case DIR_INCBIN:
+      case DIR_SPACE:
+      case DIR_FILL: size = 4; break;
       default: break;
     }
   }
@@ -306,12 +463,17 @@ immed_in_bounds(Statement_t stm, long immed)
 
 /*
  * Parses tok as a string token and updates stm and flags accordingly.
- * Sets the .asciz directive's string field.
+ * Sets the .asciz directive's string field, or the .incbin directive's path.
  * Always returns 0 to indicate no erros.
  */
 static int  /* always 0 */
 parse_string(Token_t tok, Statement_t *stm, long *flags)
 {
+  if(stm->inst.di_inst.dirid == DIR_INCBIN) {
+    stm->inst.di_inst.dir.Bdir.path = tok.value.str;
+    *flags = EXP_IMMED | EXP_END;  /* optionally followed by an offset and a length */
+    return 0;
+  }
   stm->inst.di_inst.dir.Sdir.str = tok.value.str;
   *flags = EXP_END;
   return 0;
@@ -322,25 +484,104 @@ parse_string(Token_t tok, Statement_t *stm, long *flags)
  */
 Statement_t* parse_file(FILE *file)
 {
-  enum ErrId errid;
-  Statement_t *statements = calloc((MAX_PROG_LINES+1), sizeof(Statement_t));
-  char line[LINE_BUFFER_SIZE];
+  int max = MAX_PROG_LINES + 1;  /* macros may expand to more statements than lines */
+  Statement_t *statements = calloc(max, sizeof(Statement_t));
   int i = 0;
-  while (NULL != fgets(line, LINE_BUFFER_SIZE, file)) {
-    if (0 != (errid = parse_line(line, &statements[i]))) {  /* error occured */
-      error_occurred = 1;
-      error.line_ind = i+1;
-      print_error(error);
-      free(error.line);
+  PROBE2(phase__start, "parse", filename);
+  while (parse_next_statement(file, &statements[i], i+1, 1)) {
+    if (++i == max) {
+      max *= 2;
+      statements = realloc(statements, max * sizeof(Statement_t));
     }
-    statements[i].line_ind = i+1;
-    i++;
   }
   statements[i].type = STATEMENT_END;
+  PROBE3(phase__done, "parse", filename, i);
   return statements;
 }
 
 
+/*
+ * Parses the next statement of the assembly source code in file into stm,
+ * whose index is stm_ind (starting at 1, on every pass over the file).
+ * The statements are the lines of the file, except for macros: the lines of their
+ * definitions are ignored statements, and each call is expanded into the statements
+ * of the macro's body, which all have the line index of the call.
+ * Likewise, the li pseudo-operation is expanded into a sequence of operations.
+ * If report is set, a syntax error in the statement is printed (and error_occurred is set),
+ * allowing a file to be parsed more than once while reporting its errors only once.
+ * Returns 0 if there are no more statements in file, else 1.
+ */
+int  /* 0 on end of file */
+parse_next_statement(FILE *file, Statement_t *stm, int stm_ind, int report)
+{
+  char line[LINE_BUFFER_SIZE];
+  int errid;
+  if (stm_ind == 1) {  /* a pass over the file starts */
+    reset_local_labels();
+    reset_macros();
+    li_cnt = li_next = 0;
+  }
+  if (li_next < li_cnt) {
+    *stm = li_seq[li_next++];
+    errid = 0;
+  } else if (expansion.macro != NULL) {
+    errid = expand_next(stm);
+  } else if (NULL != fgets(line, LINE_BUFFER_SIZE, file)) {
+    source_line++;
+    PROBE2(line__start, filename, source_line);
+    errid = parse_source_line(line, stm);
+    PROBE3(line__done, filename, source_line, errid);
+  } else if (defining != -1) {  /* end of file within a macro definition */
+    memset(stm, 0, sizeof(*stm));
+    stm->type = STATEMENT_IGNORE;
+    source_line = macros[defining].line_ind;
+    errid = macro_error(EMACRO_NO_END, NULL, 0);
+    defining = -1;
+  } else {
+    return 0;
+  }
+  if (0 != errid) {  /* error occured */
+    if (report) {
+      error_occurred = 1;
+      error.line_ind = source_line;
+      print_error(error);
+    }
+    free(error.line);
+    free(error.call_line);
+  }
+  if (0 == errid && stm->type == STATEMENT_OPERATION && stm->inst.op_inst.opcode == OP_LI)
+    expand_li(stm);
+  stm->line_ind = source_line;
+  return 1;
+}
+
+
+/*
+ * Parses a single line of assembly source code (without its newline) into stm,
+ * leaving line intact. On failure, the error is stored in err (without the
+ * erroneous line - err->line is NULL) and its id is returned, else 0.
+ * Used by the language server, which parses lines independently (see "lsp.c"):
+ * the local labels are forgotten before every line, as no line follows another.
+ */
+int  /* error id - nonzero on failure */
+parse_statement(const char *line, Statement_t *stm, Error_t *err)
+{
+  char *line_cpy = malloc(strlen(line) + 2);  /* the tokenizer modifies the line */
+  int errid;
+  strcpy(line_cpy, line);
+  strcat(line_cpy, "\n");  /* the tokenizer expects the newline, as read by fgets */
+  reset_local_labels();
+  errid = parse_line(line_cpy, stm);
+  free(line_cpy);
+  if(errid != 0) {
+    free(error.line);
+    error.line = NULL;
+    *err = error;
+  }
+  return errid;
+}
+
+
 /*
  * Parses the assembly source code in line into a statement.
  * On failure, updates the static error variable and returns the error id.
@@ -351,12 +592,7 @@ parse_line(char *line, Statement_t *statement)
   enum ErrId errid;
   Token_t token;
   char *line_cpy = malloc(strlen(line)+1);
-  /* initial flags */
-  long flags =  EXP_LABELDEF |  /* line may start with a label definiton */
-                EXP_COMMENT  |  /* line may be a comment */
-                EXP_END      |  /* line may be empty */
-                EXP_OP       |  /* line may start with an operation */
-                EXP_DIR;        /* line may start with a directive */
+  long flags = LINE_FLAGS;  /* initial flags */
 
   strcpy(line_cpy, line);
   memset(statement, 0, sizeof(*statement));
@@ -368,12 +604,13 @@ parse_line(char *line, Statement_t *statement)
   for (token = next_token(line); ; token = next_token(NULL)) {
     if(0 != (errid = parse_token(token, statement, &flags))) {  /* error occured */
       /* free the token's allocated string value */
-      if(  token.type == TOK_STRING
-        || token.type == TOK_LABEL)
+      if(token.type == TOK_STRING)
         free(token.value.str);
       goto Error;
     }
     if(statement->type == STATEMENT_IGNORE || token.type == TOK_END) break;
+    /* fast path for the immediates of array directives */
+    if(token.type == TOK_DIR && 0 == parse_array(statement)) break;
   }
   free(line_cpy);
   return 0;
@@ -384,36 +621,501 @@ Error:
     error.line = line_cpy;
     error.tok = token;
     error.flags = flags;
+    error.macro_line = 0;
+    error.call_line = NULL;
     return errid;
 }
 
+/* ----- macros ------------------------------------------- */
+
 /*
- * Frees all the statement's allocated memory.
+ * Parses a line read from the source file into stm: either a line of a macro
+ * definition (an ignored statement), a macro call (whose expansion starts
+ * with stm, see call_macro), or a line of assembly source code.
+ * On failure, updates the static error variable and returns the error id.
+ */
+static int  /* error id - nonzero on failure */
+parse_source_line(char *line, Statement_t *stm)
+{
+  char *line_cpy, *term, *name, *labeldef = NULL;
+  size_t len, name_len;
+  int i, errid = 0;
+  term = line + strspn(line, WSPACE_CHARS);
+  len = strcspn(term, WSPACE_CHARS);
+  if (defining == -1 && macros_cnt == 0
+      && !(len == strlen(MACRO_DIR) && 0 == strncmp(term, MACRO_DIR, len)))
+    return parse_line(line, stm);  /* the common case - no macros */
+
+  if (defining != -1) {  /* a line of the body, or its end */
+    memset(stm, 0, sizeof(*stm));
+    stm->type = STATEMENT_IGNORE;
+    if (len == strlen(ENDM_DIR) && 0 == strncmp(term, ENDM_DIR, len))
+      defining = -1;
+    else
+      add_macro_line(&macros[defining], line);
+    return 0;
+  }
+  line_cpy = malloc(strlen(line) + 1);  /* the line is split into terms in place */
+  strcpy(line_cpy, line);
+  term = line_cpy + (term - line);
+  if (len == strlen(MACRO_DIR) && 0 == strncmp(term, MACRO_DIR, len)) {
+    memset(stm, 0, sizeof(*stm));
+    stm->type = STATEMENT_IGNORE;
+    errid = define_macro(term + len, line);
+    free(line_cpy);
+    return errid;
+  }
+  name = term;
+  name_len = len;
+  if (len > 0 && term[len - 1] == ':') {  /* the call may define a label */
+    labeldef = term;
+    name = term + len;
+    name += strspn(name, WSPACE_CHARS);
+    name_len = strcspn(name, WSPACE_CHARS);
+  }
+  if (-1 == (i = search_macro(name, name_len))) {
+    free(line_cpy);
+    return parse_line(line, stm);
+  }
+  if (labeldef != NULL)
+    labeldef[len] = '\0';
+  errid = call_macro(&macros[i], labeldef, name + name_len, line, stm);
+  free(line_cpy);
+  return errid;
+}
+
+
+/*
+ * Defines a macro from the rest of its .macro line: its name, followed by
+ * its comma-separated parameters. Its body follows, up to the .endm line.
+ * An invalid definition still defines a macro that can't be called, so that
+ * its body isn't assembled.
+ * On failure, updates the static error variable and returns the error id.
+ */
+static int  /* error id - nonzero on failure */
+define_macro(char *rest, char *line)
+{
+  struct macro *macro;
+  char *name, *param;
+  size_t len;
+  int errid = 0;
+  if (macros_cnt == macros_max) {
+    macros_max = macros_max == 0 ? 8 : macros_max * 2;
+    macros = realloc(macros, macros_max * sizeof(struct macro));
+  }
+  defining = macros_cnt++;
+  macro = &macros[defining];
+  memset(macro, 0, sizeof(*macro));
+  macro->line_ind = source_line;
+
+  name = rest + strspn(rest, WSPACE_CHARS);
+  len = strcspn(name, WSPACE_CHARS ",;");
+  rest = name + len;
+  rest += strspn(rest, WSPACE_CHARS);
+  if (*rest == ',')
+    rest++;
+  name[len] = '\0';
+  while (NULL != (param = next_macro_item(&rest))) {
+    if (macro->params_cnt == MAX_MACRO_PARAMS || !is_macro_name(param)) {
+      errid = EINVAL_MACRO;
+      break;
+    }
+    macro->params[macro->params_cnt] = malloc(strlen(param) + 1);
+    strcpy(macro->params[macro->params_cnt++], param);
+  }
+  if (errid == 0 && (!is_macro_name(name) || -1 != search_op(name)))
+    errid = EINVAL_MACRO;
+  if (errid == 0 && -1 != search_macro(name, len))
+    errid = EMACRO_REDEF;
+  macro->name = malloc(len + 1);
+  strcpy(macro->name, errid == 0 ? name : "");
+  return errid == 0 ? 0 : macro_error(errid, line, 0);
+}
+
+
+/*
+ * Adds line to the body of macro. The line is tokenized once, into a template
+ * of its statement: local labels are left unresolved, and each parameter
+ * (a PARAM_CHAR-prefixed term) is marked with its index, to be substituted by
+ * the argument of a call (see instantiate_line).
  */
 static void
-free_statement(Statement_t stm)
+add_macro_line(struct macro *macro, char *line)
 {
-  free(stm.label);
-  /* operation statement */
-  if(stm.type == STATEMENT_OPERATION) {
-    switch(OPCODE_TO_OPTYPE(stm.inst.op_inst.opcode)) {
-      case OPTYPE_I:
-        free(stm.inst.op_inst.op.Iop.label);
-        break;
-      case OPTYPE_J:
-        free(stm.inst.op_inst.op.Jop.label);
-      case OPTYPE_R:
-        break;
+  struct template_line *tl;
+  Token_t tok;
+  char *term;
+  int i;
+  if (macro->lines_cnt == macro->lines_max) {
+    macro->lines_max = macro->lines_max == 0 ? 8 : macro->lines_max * 2;
+    macro->lines = realloc(macro->lines, macro->lines_max * sizeof(struct template_line));
+  }
+  tl = &macro->lines[macro->lines_cnt++];
+  memset(tl, 0, sizeof(*tl));
+  tl->line_ind = source_line;
+  tl->text = malloc(strlen(line) + 1);
+  strcpy(tl->text, line);
+  set_templating(1);
+  for (tok = next_token(line); ; tok = next_token(NULL)) {
+    tl->toks = realloc(tl->toks, (tl->toks_cnt + 1) * sizeof(Token_t));
+    tl->params = realloc(tl->params, (tl->toks_cnt + 1) * sizeof(int));
+    tl->params[tl->toks_cnt] = -1;
+    if (tok.type == TOK_ERR && tok.ind >= 0) {
+      term = line + tok.ind;
+      term += strspn(term, WSPACE_CHARS);
+      for (i = 0; *term == PARAM_CHAR && i < macro->params_cnt; i++) {
+        if (0 == strcmp(term + 1, macro->params[i]))
+          tl->params[tl->toks_cnt] = i;
+      }
+    }
+    tl->toks[tl->toks_cnt++] = tok;
+    if (tok.type == TOK_END)
+      break;
+  }
+  set_templating(0);
+}
+
+
+/*
+ * Starts the expansion of a call of macro, whose (already split) label definition
+ * is labeldef (or NULL), and whose comma-separated arguments are in rest.
+ * The first statement of the expansion is parsed into stm.
+ * On failure, updates the static error variable and returns the error id.
+ */
+static int  /* error id - nonzero on failure */
+call_macro(struct macro *macro, char *labeldef, char *rest, char *line, Statement_t *stm)
+{
+  long flags = EXP_LABELDEF;
+  Token_t tok;
+  char *arg;
+  int errid;
+  memset(stm, 0, sizeof(*stm));
+  stm->type = STATEMENT_IGNORE;
+  if (labeldef != NULL) {
+    tok = tokenize_arg(labeldef);
+    if (tok.type != TOK_LABELDEF)
+      return macro_error(EUNEXPECTED_TOK, line, 0);
+    if (0 != (errid = parse_labeldef(tok, stm, &flags)))
+      return macro_error(errid, line, 0);
+  }
+  expansion.label = stm->label;
+  stm->label = 0;
+  expansion.macro = macro;
+  expansion.next = 0;
+  expansion.line = strcpy(malloc(strlen(line) + 1), line);
+  while (NULL != (arg = next_macro_item(&rest)) && expansion.argc < MAX_MACRO_PARAMS)
+    expansion.args[expansion.argc++] = tokenize_arg(arg);
+  if (arg != NULL || expansion.argc != macro->params_cnt) {
+    end_expansion();
+    return macro_error(EMACRO_ARGS, line, 0);
+  }
+  if (macro->lines_cnt == 0) {  /* an empty body */
+    errid = expansion.label == 0 ? 0 : EMACRO_LABEL;
+    end_expansion();
+    return errid == 0 ? 0 : macro_error(errid, line, 0);
+  }
+  return expand_next(stm);
+}
+
+
+/*
+ * Parses the next line of the body of the macro being expanded into stm.
+ * The label of the call is defined by the first statement of the expansion
+ * (which must not define its own label).
+ * On failure, updates the static error variable and returns the error id.
+ */
+static int  /* error id - nonzero on failure */
+expand_next(Statement_t *stm)
+{
+  struct macro *macro = expansion.macro;
+  struct template_line *tl = &macro->lines[expansion.next++];
+  int errid = instantiate_line(tl, stm);
+  int last = expansion.next == macro->lines_cnt;
+  if (errid == 0 && expansion.label != 0
+      && stm->type != STATEMENT_IGNORE && stm->type != STATEMENT_ERROR) {
+    if (stm->label != 0)  /* the statement defines its own label */
+      errid = macro_error(EMACRO_LABEL, tl->text, tl->line_ind);
+    stm->label = expansion.label;
+    expansion.label = 0;
+  }
+  if (errid == 0 && last && expansion.label != 0)
+    errid = macro_error(EMACRO_LABEL, NULL, 0);
+  if (last)
+    end_expansion();
+  return errid;
+}
+
+
+/*
+ * Instantiates the template line tl of the macro being expanded into stm,
+ * substituting the arguments of the call for its parameters, and resolving
+ * its local labels in place of the call.
+ * On failure, updates the static error variable and returns the error id.
+ */
+static int  /* error id - nonzero on failure */
+instantiate_line(struct template_line *tl, Statement_t *stm)
+{
+  long flags = LINE_FLAGS;
+  enum ErrId errid;
+  Token_t tok;
+  int i;
+  memset(stm, 0, sizeof(*stm));
+  for (i = 0; i < tl->toks_cnt; i++) {
+    tok = tl->params[i] == -1 ? tl->toks[i] : expansion.args[tl->params[i]];
+    tok.ind = tl->toks[i].ind;
+    if (tok.type == TOK_STRING) {  /* the statement takes ownership of a string */
+      tok.value.str = strcpy(malloc(strlen(tok.value.str) + 1), tok.value.str);
+    } else if ((tok.type == TOK_LABEL || tok.type == TOK_LABELDEF)
+               && tl->params[i] == -1 && IS_LOCAL_LABEL(tok.value.label)) {
+      tok.value.label = resolve_local_label(tok.value.label);
+    }
+    if (0 != (errid = parse_token(tok, stm, &flags))) {  /* error occured */
+      if (tok.type == TOK_STRING)
+        free(tok.value.str);
+      free_statement(*stm);
+      stm->type = STATEMENT_ERROR;
+      macro_error(errid, tl->text, tl->line_ind);
+      error.tok = tok;
+      error.flags = flags;
+      return errid;
+    }
+    if (stm->type == STATEMENT_IGNORE || tok.type == TOK_END) break;
+  }
+  stm->macro_line = tl->line_ind;
+  return 0;
+}
+
+
+/*
+ * Ends the expansion of the current macro call, freeing its arguments and line.
+ */
+static void
+end_expansion()
+{
+  int i;
+  for (i = 0; i < expansion.argc; i++) {
+    if (expansion.args[i].type == TOK_STRING)
+      free(expansion.args[i].value.str);
+  }
+  free(expansion.line);
+  memset(&expansion, 0, sizeof(expansion));
+}
+
+
+/*
+ * Forgets all the macros, so that they're defined anew on every pass over a file.
+ */
+static void
+reset_macros()
+{
+  struct template_line *tl;
+  int i, j, k;
+  end_expansion();
+  for (i = 0; i < macros_cnt; i++) {
+    for (j = 0; j < macros[i].params_cnt; j++)
+      free(macros[i].params[j]);
+    for (j = 0; j < macros[i].lines_cnt; j++) {
+      tl = &macros[i].lines[j];
+      for (k = 0; k < tl->toks_cnt; k++) {
+        if (tl->toks[k].type == TOK_STRING)
+          free(tl->toks[k].value.str);
+      }
+      free(tl->toks);
+      free(tl->params);
+      free(tl->text);
     }
+    free(macros[i].lines);
+    free(macros[i].name);
+  }
+  macros_cnt = 0;
+  defining = -1;
+  source_line = 0;
+}
+
+
+/*
+ * Returns the index of the macro whose name is the first len characters of name,
+ * or -1 if there's no such macro.
+ */
+static int  /* index of the macro */
+search_macro(const char *name, size_t len)
+{
+  int i;
+  for (i = 0; len > 0 && i < macros_cnt; i++) {
+    if (macros[i].name != NULL  /* NULL while its definition is parsed */
+        && strlen(macros[i].name) == len && 0 == strncmp(macros[i].name, name, len))
+      return i;
   }
+  return -1;
+}
+
+
+/*
+ * Determines whether name is a valid name of a macro or of a parameter:
+ * an alphabetic character followed by alphanumeric characters, as a label.
+ */
+static int  /* 1 iff valid */
+is_macro_name(char *name)
+{
+  size_t len = strlen(name), i;
+  if (len == 0 || len > MAX_LABEL_LEN || !isalpha((unsigned char)name[0]))
+    return 0;
+  for (i = 1; i < len; i++) {
+    if (!isalnum((unsigned char)name[i]))
+      return 0;
+  }
+  return 1;
+}
+
+
+/*
+ * Returns the next item of the comma-separated list in *rest (stripped of whitespace,
+ * and terminated in place), and advances *rest past it.
+ * Commas within strings don't separate items, and the list ends at a comment.
+ * Returns NULL if there are no more items.
+ */
+static char*  /* the item */
+next_macro_item(char **rest)
+{
+  char *item = *rest + strspn(*rest, WSPACE_CHARS), *c, *end;
+  int quoted = 0;
+  if (*item == '\0' || *item == COMMENT_CHAR)
+    return NULL;
+  for (c = item; *c != '\0' && (quoted || (*c != ',' && *c != COMMENT_CHAR)); c++) {
+    if (*c == '"')
+      quoted = !quoted;
+  }
+  *rest = c + (*c == ',');
+  for (end = c; end > item && isspace((unsigned char)end[-1]); end--)
+    ;
+  *c = '\0';
+  *end = '\0';
+  return item;
+}
+
+
+/*
+ * Updates the static error variable with an error of a macro definition or call,
+ * in line (if not NULL), expanded from macro_line (if nonzero) - in which case
+ * the error is reported at the line of the call as well.
+ * Returns errid.
+ */
+static int  /* the error id */
+macro_error(enum ErrId errid, const char *line, int macro_line)
+{
+  memset(&error, 0, sizeof(error));
+  error.errid = errid;
+  error.tok.ind = -1;
+  error.macro_line = macro_line;
+  if (line != NULL)
+    error.line = strcpy(malloc(strlen(line) + 1), line);
+  if (macro_line != 0 && expansion.line != NULL)
+    error.call_line = strcpy(malloc(strlen(expansion.line) + 1), expansion.line);
+  return errid;
+}
+
+
+/* ----- li pseudo-operation ------------------------------ */
+
+/*
+ * Expands the li pseudo-operation stm ("li $r, imm32") into the shortest sequence
+ * of operations that loads its 32-bit value into its register. As there's
+ * neither a shift nor a load-upper operation, the value is built as (x << k) + y:
+ *    addi $0, x, $r     (or subi $0, -32768, $r for x = 32768)
+ *    add $r, $r, $r     k times - each doubles $r
+ *    addi $r, y, $r     if y isn't 0 (or subi $r, -32768, $r)
+ * followed by nori $r, 0, $r if it's shorter to build the complement of the value.
+ * e.g: a value within 16-bit bounds takes a single addi, 65536 takes subi $0, -32768, $r
+ *      (32768) followed by one doubling, and 0x12345678 takes 16 operations.
+ * stm is replaced by the first operation, the rest follow it (see parse_next_statement).
+ */
+static void
+expand_li(Statement_t *stm)
+{
+  int reg = stm->inst.op_inst.op.Jop.reg;
+  long value = stm->inst.op_inst.op.Jop.addr;
+  long v, x, y, d, best_x = 0, best_y = 0;
+  int not, k, best_k = 0, best_not = 0, best_cnt = MAX_LI_LEN + 1, cnt, i;
+  for (not = 0; not <= 1; not++) {
+    v = not ? ~value : value;
+    for (k = 0, d = 1; k <= 16; k++, d *= 2) {
+      /* x rounded down and up, as y then fits the bounds only if it's small */
+      for (x = (v - ((v % d) + d) % d) / d, i = 0; i < 2; i++, x++) {
+        y = v - x * d;
+        cnt = 1 + k + (y != 0) + not;
+        if (LI_IN_BOUNDS(x) && LI_IN_BOUNDS(y) && cnt < best_cnt) {
+          best_cnt = cnt;
+          best_x = x, best_y = y, best_k = k, best_not = not;
+        }
+      }
+    }
+  }
+  li_cnt = li_next = 0;
+  li_operation(&li_seq[li_cnt++], OP_ADDI, 0, best_x, reg);
+  for (k = 0; k < best_k; k++)
+    li_operation(&li_seq[li_cnt++], OP_ADD, reg, reg, reg);
+  if (best_y != 0)
+    li_operation(&li_seq[li_cnt++], OP_ADDI, reg, best_y, reg);
+  if (best_not)
+    li_operation(&li_seq[li_cnt++], OP_NORI, reg, 0, reg);
+  li_seq[0].label = stm->label;
+  for (i = 0; i < li_cnt; i++)
+    li_seq[i].macro_line = stm->macro_line;
+  *stm = li_seq[li_next++];
+}
+
+
+/*
+ * Sets stm to the operation opid with the operands rs, immed (for an I-type operation,
+ * or the rt register for a R-type one) and rt (or rd), as a statement of an expanded li.
+ * An addi of 32768 (out of 16-bit bounds) is set as a subi of -32768.
+ */
+static void
+li_operation(Statement_t *stm, enum OpId opid, int rs, long immed, int rt)
+{
+  OpInstruction_t *op_inst = &stm->inst.op_inst;
+  memset(stm, 0, sizeof(*stm));
+  stm->type = STATEMENT_OPERATION;
+  if (opid == OP_ADDI && immed == 32768) {
+    opid = OP_SUBI;
+    immed = -32768;
+  }
+  op_inst->opcode = opid & OPCODE_MASK;
+  if (OPID_TO_OPTYPE(opid) == OPTYPE_R) {
+    op_inst->op.Rop.funct = opid >> FUNCT_SHIFT;
+    op_inst->op.Rop.rs = rs;
+    op_inst->op.Rop.rt = immed;
+    op_inst->op.Rop.rd = rt;
+  } else {
+    op_inst->op.Iop.rs = rs;
+    op_inst->op.Iop.immed = immed;
+    op_inst->op.Iop.rt = rt;
+  }
+}
+
+
+/*
+ * Frees all the statement's allocated memory.
+ * Labels are interned (see "intern.c"), and therefore aren't freed.
+ */
+void
+free_statement(Statement_t stm)
+{
   /* directive statement */
-  else if(stm.type == STATEMENT_DIRECTIVE) {
+  if(stm.type == STATEMENT_DIRECTIVE) {
     switch(stm.inst.di_inst.dirid) {
-      case DIR_ENTRY:
-      case DIR_EXTERN:
       case DIR_ASCIZ:
         free(stm.inst.di_inst.dir.Sdir.str);
         break;
+      case DIR_INCBIN:
+        free(stm.inst.di_inst.dir.Bdir.path);
+        break;
+      case DIR_ENTRY:
+      case DIR_EXTERN:
+      case DIR_ALIGN:
+      case DIR_SPACE:
+      case DIR_FILL:
+        break;
       default:
         free(stm.inst.di_inst.dir.Adir.argv);
     }
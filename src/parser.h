@@ -1,7 +1,9 @@
 /* ===== parser.h =========================================
  * Header file for "parser.c".
  * Contains definition for EXP_* flags used both in "parser.c" and in "errors.c".
- * Exposes the parser's main function: parse_file
+ * Exposes the parser's main function: parse_file, parse_next_statement
+ * for parsing a file one statement at a time, parse_statement for parsing a single line,
+ * and free_statement, used by passes that delete statements.
  */
 #ifndef PARSER_H
 #define PARSER_H
@@ -9,6 +11,7 @@
 
 #include <stdio.h>
 #include "types.h"
+#include "errors.h"
 
 /* ===== CPP Definitions ================================== */
 /* ----- flags -------------------------------------------- */
@@ -26,6 +29,9 @@
 #define REG_RD        (1 << 12)   /* currently parsed register is RD  */
 
 Statement_t* parse_file(FILE *file);
+int parse_next_statement(FILE *file, Statement_t *stm, int line_ind, int report);
+int parse_statement(const char *line, Statement_t *stm, Error_t *err);
+void free_statement(Statement_t stm);
 
 
 #endif
@@ -0,0 +1,47 @@
+/* ===== probes.h =========================================
+ * USDT (user-level statically defined tracing) probe points of the assembler,
+ * for tracing its runs with bpftrace, perf or systemtap (see "tools/phases.bt").
+ * The probes are compiled out by default. Build with `make USDT=1` to compile them in
+ * (requires <sys/sdt.h>, e.g. from the systemtap-sdt-dev package); a compiled-in
+ * probe is a single nop instruction until a tracer attaches to it.
+ *
+ * Probes of the "assembler" provider, and their arguments:
+ *  phase__start(phase, file)         a phase of assembling a file started/ended. phases:
+ *  phase__done(phase, file, count)   "parse"       - count of statements
+ *                                    "memory"      - DC, size of the memory image
+ *                                    "instruction" - ICF, size of the instruction image
+ *                                    "streamed"    - count of statements (--low-memory)
+ *                                    "cache"       - count of statements loaded (--cache)
+ *                                    ".ob", ".ent", ".ext" - count of bytes written
+ *                                    "stdout"      - count of bytes of the images (--stdout)
+ *  line__start(file, line_ind)       parsing a line of a file started/ended,
+ *  line__done(file, line_ind, errid)   errid is the id of its syntax error or 0
+ *  symbol__hit(name, index)          a symbol searched was found at index of the table
+ *  symbol__miss(name)                a symbol searched wasn't found
+ *  symbol__add(name, attr, size)     a symbol was added, size is the new table size
+ *  label__conflict(file, line_ind, name, errid)  a label definition/declaration conflicts
+ */
+#ifndef PROBES_H
+#define PROBES_H
+
+
+#ifdef USDT
+
+#include <sys/sdt.h>
+
+#define PROBE1(name, a)          DTRACE_PROBE1(assembler, name, a)
+#define PROBE2(name, a, b)       DTRACE_PROBE2(assembler, name, a, b)
+#define PROBE3(name, a, b, c)    DTRACE_PROBE3(assembler, name, a, b, c)
+#define PROBE4(name, a, b, c, d) DTRACE_PROBE4(assembler, name, a, b, c, d)
+
+#else  /* compiled out - the arguments aren't evaluated */
+
+#define PROBE1(name, a)          ((void)0)
+#define PROBE2(name, a, b)       ((void)0)
+#define PROBE3(name, a, b, c)    ((void)0)
+#define PROBE4(name, a, b, c, d) ((void)0)
+
+#endif
+
+
+#endif
@@ -0,0 +1,294 @@
+/* ===== relax.c ==========================================
+ * This module performs branch relaxation: a branch operation encodes the offset
+ * of its target in its 16-bit immed field, so a branch whose target is further
+ * than that (about 32KB either way) is rewritten into operations that reach it
+ * with a jmp, whose 25-bit address field spans the whole program:
+ *    beq $1, $2, FAR      ->    bne $1, $2, +8    (the inverted branch skips the jmp)
+ *                               jmp FAR
+ *    blt $1, $2, FAR      ->    blt $1, $2, +8    (there's no inverted blt/bgt)
+ *                               beq $0, $0, +8    (always taken - skips the jmp)
+ *                               jmp FAR
+ * Relaxing a branch moves the operations that follow it, which may put other
+ * branches out of range. The layout is therefore iterated to a fixpoint, starting
+ * with all branches short: as relaxing only ever lengthens the code, it converges,
+ * and every branch that isn't relaxed keeps its single operation.
+ *
+ * The layout is recorded from the statements in order (see add_layout_stm), so that
+ * it can be built while streaming the source file as well (see write_images_streamed).
+ * Only branches to code labels are relaxed. The offsets of data labels depend on the
+ * memory image, so such branches are left for "scan.c" to check.
+ */
+
+/* ===== Includes ========================================= */
+#include <stdlib.h>
+#include <string.h>
+#include "relax.h"
+#include "types.h"
+#include "consts.h"
+
+/* ===== CPP definitons =================================== */
+#define LAYOUT_INIT 64  /* initial count of labels & branches in the layout */
+/* count of operations added by relaxing a branch of the given opcode */
+#define RELAX_EXTRA(opcode) ((opcode) == OP_BEQ || (opcode) == OP_BNE ? 1 : 2)
+
+/* ===== Declarations ===================================== */
+/* a label defined on an operation */
+struct layout_label {
+  int name;   /* id of the label          */
+  long op;    /* index of the operation   */
+};
+
+/* a branch operation */
+struct layout_branch {
+  long op;      /* index of the operation                                   */
+  long target;  /* index of the operation of its target, or -1 if not code  */
+  int label;    /* id of its target label                                   */
+  int opcode;
+  int extra;    /* count of operations added by relaxing it, 0 if it isn't  */
+  long before;  /* count of operations added by the branches before it      */
+};
+
+static struct layout_label *labels;
+static int labels_cnt, labels_max;
+static struct layout_branch *branches;  /* in order of their operations */
+static int branches_cnt, branches_max;
+static long ops_cnt;    /* count of operations recorded                         */
+static long next_op;    /* index of the next operation relaxed, see relax_stm   */
+static int next_branch; /* index of the first branch not before next_op         */
+
+/* ----- prototypes --------------------------------------- */
+void init_layout();
+void add_layout_stm(Statement_t stm);
+long solve_layout();
+void rewind_layout();
+int relax_stm(Statement_t stm, Statement_t *seq);
+void cleanup_layout();
+Statement_t* relax_branches(Statement_t *statements);
+
+static int label_cmp(const void *label1, const void *label2);
+static long added_before(long op);
+
+
+/* ===== Code ============================================= */
+
+/*
+ * Comparison function between the name ids of layout labels to be used as a comparison key.
+ */
+static int
+label_cmp(const void *label1, const void *label2)
+{
+  const struct layout_label * const plabel1 = label1;
+  const struct layout_label * const plabel2 = label2;
+  return (plabel1->name > plabel2->name) - (plabel1->name < plabel2->name);
+}
+
+
+/*
+ * Initializes an empty layout.
+ */
+void
+init_layout()
+{
+  labels_cnt = branches_cnt = 0;
+  labels_max = branches_max = LAYOUT_INIT;
+  labels = malloc(labels_max * sizeof(struct layout_label));
+  branches = malloc(branches_max * sizeof(struct layout_branch));
+  ops_cnt = 0;
+  rewind_layout();
+}
+
+
+/*
+ * Records the next statement of the program into the layout:
+ * its label, if it's an operation, and its target, if it's a branch.
+ */
+void
+add_layout_stm(Statement_t stm)
+{
+  struct layout_branch *branch;
+  if(stm.type != STATEMENT_OPERATION)
+    return;
+  if(stm.label != 0) {
+    if(labels_cnt == labels_max) {
+      labels_max *= 2;
+      labels = realloc(labels, labels_max * sizeof(struct layout_label));
+    }
+    labels[labels_cnt].name = stm.label;
+    labels[labels_cnt++].op = ops_cnt;
+  }
+  if(IS_BRANCH_OP(stm.inst.op_inst.opcode) && stm.inst.op_inst.op.Iop.label != 0) {
+    if(branches_cnt == branches_max) {
+      branches_max *= 2;
+      branches = realloc(branches, branches_max * sizeof(struct layout_branch));
+    }
+    branch = &branches[branches_cnt++];
+    branch->op = ops_cnt;
+    branch->label = stm.inst.op_inst.op.Iop.label;
+    branch->opcode = stm.inst.op_inst.opcode;
+    branch->extra = 0;
+  }
+  ops_cnt++;
+}
+
+
+/*
+ * Returns the count of operations added by the relaxed branches before operation op.
+ * Prerequisite: the before fields of the branches are up to date.
+ */
+static long  /* count of added operations */
+added_before(long op)
+{
+  int low = 0, high = branches_cnt, mid;
+  while(low < high) {  /* the first branch that isn't before op */
+    mid = (low + high) / 2;
+    if(branches[mid].op < op)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  if(low == branches_cnt)
+    return branches_cnt == 0 ? 0 : branches[low-1].before + branches[low-1].extra;
+  return branches[low].before;
+}
+
+
+/*
+ * Determines which of the recorded branches are relaxed, iterating the layout
+ * to a fixpoint (see the documentation of this module).
+ * Returns the count of bytes added to the instruction image.
+ */
+long  /* count of added bytes */
+solve_layout()
+{
+  struct layout_label key, *label;
+  struct layout_branch *branch;
+  long offset;
+  int i, changed;
+  qsort(labels, labels_cnt, sizeof(struct layout_label), label_cmp);
+  for(i=0; i<branches_cnt; i++) {
+    key.name = branches[i].label;
+    label = bsearch(&key, labels, labels_cnt, sizeof(struct layout_label), label_cmp);
+    branches[i].target = label == NULL ? -1 : label->op;
+  }
+  do {
+    changed = 0;
+    for(i=0; i<branches_cnt; i++)
+      branches[i].before = i == 0 ? 0 : branches[i-1].before + branches[i-1].extra;
+    for(i=0; i<branches_cnt; i++) {
+      branch = &branches[i];
+      if(branch->extra != 0 || branch->target == -1)
+        continue;
+      offset = 4 * (branch->target + added_before(branch->target)
+                    - (branch->op + branch->before));
+      if(!IN_BOUNDS(offset, 16)) {
+        branch->extra = RELAX_EXTRA(branch->opcode);
+        changed = 1;
+      }
+    }
+  } while(changed);
+  rewind_layout();
+  return 4 * added_before(ops_cnt);
+}
+
+
+/*
+ * Restarts relax_stm at the first statement of the program, for another pass over it.
+ */
+void
+rewind_layout()
+{
+  next_op = 0;
+  next_branch = 0;
+}
+
+
+/*
+ * Relaxes the next statement of the program (the statements are passed in the
+ * same order they were recorded in): stores the statements that replace it in seq
+ * (which should have room for RELAX_MAX_STMS statements) and returns their count -
+ * 1 if it isn't a relaxed branch, in which case seq holds stm itself.
+ * The statements that replace a relaxed branch have its line, and the first one
+ * has its label.
+ * Prerequisite: the layout is solved (see solve_layout).
+ */
+int  /* count of statements in seq */
+relax_stm(Statement_t stm, Statement_t *seq)
+{
+  OpInstruction_t *op_inst;
+  long op;
+  int cnt = 0;
+  seq[0] = stm;
+  if(stm.type != STATEMENT_OPERATION)
+    return 1;
+  op = next_op++;
+  while(next_branch < branches_cnt && branches[next_branch].op < op)
+    next_branch++;
+  if(next_branch == branches_cnt || branches[next_branch].op != op
+     || branches[next_branch].extra == 0)
+    return 1;
+  /* the branch, skipping the jmp (or inverted, skipping the jmp) */
+  op_inst = &seq[cnt++].inst.op_inst;
+  if(branches[next_branch].extra == 1)
+    op_inst->opcode = op_inst->opcode == OP_BEQ ? OP_BNE : OP_BEQ;
+  op_inst->op.Iop.label = 0;
+  op_inst->op.Iop.immed = 8;
+  if(branches[next_branch].extra == 2) {  /* beq $0, $0, +8 */
+    memset(&seq[cnt], 0, sizeof(Statement_t));
+    seq[cnt].type = STATEMENT_OPERATION;
+    seq[cnt].line_ind = stm.line_ind;
+    seq[cnt].macro_line = stm.macro_line;
+    op_inst = &seq[cnt++].inst.op_inst;
+    op_inst->opcode = OP_BEQ;
+    op_inst->op.Iop.immed = 8;
+  }
+  /* jmp to the target */
+  memset(&seq[cnt], 0, sizeof(Statement_t));
+  seq[cnt].type = STATEMENT_OPERATION;
+  seq[cnt].line_ind = stm.line_ind;
+  seq[cnt].macro_line = stm.macro_line;
+  op_inst = &seq[cnt++].inst.op_inst;
+  op_inst->opcode = OP_JMP;
+  op_inst->op.Jop.label = branches[next_branch].label;
+  return cnt;
+}
+
+
+/*
+ * Frees up the layout.
+ */
+void
+cleanup_layout()
+{
+  free(labels);
+  free(branches);
+  labels = NULL;
+  branches = NULL;
+}
+
+
+/*
+ * Relaxes the branches of the array of statements (see the documentation of this module).
+ * Returns the array, or a new (longer) array that replaces it if any branch was relaxed,
+ * in which case the original array is freed.
+ */
+Statement_t*  /* the relaxed array */
+relax_branches(Statement_t *statements)
+{
+  Statement_t *relaxed, *stm;
+  long n = 0, added;
+  init_layout();
+  for(stm = statements; stm->type != STATEMENT_END; stm++, n++)
+    add_layout_stm(*stm);
+  if(0 == (added = solve_layout())) {
+    cleanup_layout();
+    return statements;
+  }
+  relaxed = malloc((n + added / 4 + 1) * sizeof(Statement_t));
+  n = 0;
+  for(stm = statements; stm->type != STATEMENT_END; stm++)
+    n += relax_stm(*stm, &relaxed[n]);
+  relaxed[n].type = STATEMENT_END;
+  free(statements);
+  cleanup_layout();
+  return relaxed;
+}
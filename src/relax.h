@@ -0,0 +1,24 @@
+/* ===== relax.h ==========================================
+ * Header file for "relax.c".
+ * Exposes relax_branches for the array of statements, and the layout
+ * functions it's built of, for relaxing the statements while streaming:
+ * init_layout, add_layout_stm, solve_layout, rewind_layout, relax_stm & cleanup_layout.
+ */
+#ifndef RELAX_H
+#define RELAX_H
+
+
+#include "types.h"
+
+#define RELAX_MAX_STMS 3  /* most statements that replace a relaxed branch */
+
+void init_layout();
+void add_layout_stm(Statement_t stm);
+long solve_layout();
+void rewind_layout();
+int relax_stm(Statement_t stm, Statement_t *seq);
+void cleanup_layout();
+Statement_t* relax_branches(Statement_t *statements);
+
+
+#endif
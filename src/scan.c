@@ -3,21 +3,114 @@
  * were parsed from the source file by "tokenizer.c" and "parser.c") and assembling
  * the symbol table and memory & instruction images - which are then used to write the 
  * ".ob", ".ent", ".ext" output files.
+ * The statements are either scanned from an array (see "parser.c"), or one at a time
+ * while streaming the source file (see write_images_streamed).
+ *
+ * Data merging (--merge-data):
+ *  Every payload written into the memory image is recorded in a hash table (for
+ *  .asciz payloads, every suffix of the string is recorded as well). A labelled
+ *  data directive whose payload was already written is not written again, instead
+ *  its label is aliased to the offset of the existing copy.
+ *
+ * Zero runs (.space, .fill):
+ *  Long runs of zero bytes aren't written into the memory image, instead they're
+ *  recorded in a table of zero runs, and the bytes that follow a run are stored
+ *  right after the bytes that precede it. Offsets in the memory image (DC, symbol
+ *  offsets) still count the runs, and are mapped to the stored bytes by mem_at.
+ *  The runs are only expanded while writing the outputs (see get_mem_byte and
+ *  get_mem_chunk).
+ *
+ * Parallel encoding (--jobs):
+ *  Once the symbol table is assembled, the encoding of an operation only depends on
+ *  the table and on its own IC. The operations are therefore split into ranges (jobs),
+ *  each encoded by its own thread into its own slice of the instruction image.
+ *  A job doesn't modify the symbol table, instead it collects its references to
+ *  symbols and its errors, which are added and printed in order once all jobs are done.
+ *
+ * Local labels ("1:", "1b", "1f"):
+ *  Every definition of a local label has an id of its own, to which its references
+ *  were already resolved by the tokenizer (see LOCAL_LABEL_ID). Local labels are
+ *  logged into a small table of their own instead of the symbol table, which is
+ *  sorted once the memory image is assembled and searched by resolve_label.
+ *  They are never exported, and never referenced externally.
+ *
+ * Check-only mode (--check):
+ *  Labels are logged and references are resolved as usual, so that all diagnostics
+ *  are reported, but no data or instruction is written into the images:
+ *  DC and IC only advance by the sizes of the data and instructions.
  */
 
 /* ===== Includes ========================================= */
 #include <stdio.h>
 #include <malloc.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include "parser.h"
 #include "tables.h"
 #include "types.h"
 #include "errors.h"
+#include "intern.h"
+#include "probes.h"
+#include "relax.h"
 #include "consts.h"
 
+/* ===== CPP definitons =================================== */
+#define DATA_BUCKETS_INIT 1024  /* initial count of buckets in the data hash table */
+#define ZERO_RUNS_INIT    16    /* initial count of zero runs in the table          */
+#define LOCAL_LABELS_INIT 64    /* initial count of local labels in their table     */
+#define ZERO_RUN_MIN      64    /* shorter zero fills are written into the image    */
+#define JOB_MIN_OPS       256   /* minimal count of operations encoded by a job     */
+
 /* ===== Declarations ===================================== */
+/* a payload recorded in the data hash table */
+struct data_entry {
+  uint32_t hash;  /* hash of the payload                           */
+  long offset;    /* offset of the payload in the memory image     */
+  long len;       /* length of the payload in bytes                */
+  int next;       /* index of the next entry in the bucket, or -1  */
+};
+
+static struct data_entry *data_entries;   /* the recorded payloads              */
+static int data_entries_cnt, data_entries_max;
+static int *data_buckets;                 /* index of the first entry, or -1    */
+static int data_buckets_cnt;
+
+/* a run of zero bytes that isn't stored in the memory image */
+struct zero_run {
+  long offset;    /* offset of the run in the memory image                      */
+  long len;       /* length of the run in bytes                                 */
+  long skipped;   /* total length of the runs up to and including this run      */
+};
+
+static struct zero_run *zero_runs;        /* the runs, ordered by offset        */
+static int zero_runs_cnt, zero_runs_max;
+
+static SymbolEntry_t *local_labels;       /* the defined local labels, see resolve_label */
+static int local_labels_cnt, local_labels_max;
+
+/* a range of statements whose operations are encoded together, see write_instruction_image */
+struct job {
+  Statement_t *first, *last;  /* the range of statements [first, last)            */
+  long ic;                    /* offset of the next instruction of the range      */
+  SymbolEntry_t *refs;        /* references to symbols, in order of IC            */
+  int refs_cnt, refs_max;
+  Error_t *errors;            /* errors & warnings, in order of lines             */
+  int errors_cnt, errors_max;
+};
+
+static long data_base;  /* address the memory image is loaded at */
+
 /* defined in "assembler.c" */
-extern char inst_img[], mem_img[];
-extern long IC, DC, ICF;
+extern char *filename, *filepath;
+extern char *inst_img, *mem_img;
+extern long mem_img_size;
+extern long IC, DC, ICF, DCF;
+extern long options;
+extern int jobs;
 
 /* defined in "tables.c" */
 extern int symtable_size;
@@ -28,15 +121,51 @@ extern int error_occurred;  /* defined in "errors.c" */
 /* ----- prototypes --------------------------------------- */
 void write_memory_image(Statement_t *statements);
 void write_instruction_image(Statement_t *statements);
+void write_images_streamed(FILE *source);
+char get_mem_byte(long offset);
+long get_mem_chunk(long offset, const char **chunk);
+int32_t encode_op_stm(OpInstruction_t op_inst);
 
-static int32_t encode_op_stm(OpInstruction_t op_inst);
-static int log_label(char *label, int attr, int line_ind);
-static void write_instruction(int32_t inst_enc);
+static int log_label(int label, int attr, Statement_t *stm);
+static int log_label_at(int label, int attr, long offset, Statement_t *stm);
+static void init_local_labels();
+static int local_label_cmp(const void *label1, const void *label2);
+static SymbolEntry_t* resolve_label(int label);
+static void write_instruction(int32_t inst_enc, long ic);
+static int reserve_memory(long size);
+static void init_zero_runs();
+static int search_zero_run(long offset);
+static char* mem_at(long offset);
+static int fill_memory(long count, int size, long value);
 static int perform_directive(Statement_t stm);
+static char* resolve_path(const char *path);
+static int include_binary(Statement_t stm);
+static void scan_memory_stm(Statement_t stm, int mergeable);
+static void scan_instruction_stm(Statement_t stm, struct job *job);
+static void init_job(struct job *job, Statement_t *first, long ic);
+static void add_reference(struct job *job, SymbolEntry_t symbol);
+static void add_job_error(struct job *job, Error_t error);
+static void* run_job(void *job);
+static void finish_job(struct job *job);
+static int split_jobs(Statement_t *statements, struct job *job_list);
+static int get_alignment(Statement_t stm);
+static int align_memory(int align);
+static int check_data_range(Statement_t stm);
+static void report_data_error(Statement_t stm, enum ErrId errid);
 static int check_symtable_integrity(Error_t *error);
-static int handle_branch_op(Op_t *op);
-static int handle_la_op(Op_t *op);
-static int handle_jmp_op(Op_t *op);
+static int handle_branch_op(Op_t *op, struct job *job);
+static int handle_la_op(Op_t *op, struct job *job);
+static int handle_jmp_op(Op_t *op, struct job *job);
+
+static uint32_t hash_data(const char *data, long len);
+static void init_data_table();
+static void cleanup_data_table();
+static void add_data_entry(long offset, long len);
+static void record_data(long offset, long len, int is_string);
+static long search_data(const char *data, long len, int align);
+static long search_payload(Statement_t stm);
+static char* get_payload(Statement_t stm, long *len);
+static int is_mergeable(Statement_t *statements, int i);
 
 /* ===== Code =============================================*/
 
@@ -44,7 +173,7 @@ static int handle_jmp_op(Op_t *op);
  * Returns the 4-byte encoding of an assembly operation instruction.
  * Makes use of various constants defined in "consts.h".
  */
-static int32_t  /* the 4-byte encoding */
+int32_t  /* the 4-byte encoding */
 encode_op_stm(OpInstruction_t op_inst)
 {
   int opcode = op_inst.opcode;
@@ -75,7 +204,19 @@ encode_op_stm(OpInstruction_t op_inst)
 
 
 /*
- * Logs a label into the symbol table.
+ * Logs a label of the statement stm into the symbol table, at the current IC
+ * for a code label or the current DC for a data label (see log_label_at).
+ */
+static int  /* nonzero on failure */
+log_label(int label, int attr, Statement_t *stm)
+{
+  long offset = (attr & SYM_CODE) ? IC : (attr & SYM_DATA) ? DC : -1 * stm->line_ind;
+  return log_label_at(label, attr, offset, stm);
+}
+
+
+/*
+ * Logs a label with the given offset into the symbol table.
  * attr is the attribute of the label (bitwise-OR of SYM_DATA, SYM_CODE, SYM_ENTRY, SYM_EXTERN, SYM_REQUIRED).
  * On success, the symbol entry is either updated or added to the symbol table and 0 is returned.
  * On failure, the error id is returned.
@@ -83,23 +224,33 @@ encode_op_stm(OpInstruction_t op_inst)
  *  ELABEL_SCOPE_MISMATCH - mismatch between entry/external attributes of current and previous encounter of the label.
  *  ELABEL_DOUBLE_DEF     - the label was already defined.
  *  ELABEL_EXT_DEF        - previously declared-external label is now defined.
- * Errors are printed to stdout using print_err, with line index line_ind.
+ * Errors are printed to stdout using print_err, at the line of the statement stm.
  */
 static int  /* nonzero on failure */
-log_label(char *label, int attr, int line_ind)
+log_label_at(int label, int attr, long offset, Statement_t *stm)
 {
   SymbolEntry_t *symbolp;
   SymbolEntry_t symbol;
-  long offset = (attr & SYM_CODE) ? IC : (attr & SYM_DATA) ? DC : -1 * line_ind;
   Error_t error;
   error.errid = 0;
-  error.line = NULL;
+  error.line = error.call_line = NULL;
   error.tok.ind = -1;
-  error.line_ind = line_ind;
+  error.line_ind = stm->line_ind;
+  error.macro_line = stm->macro_line;
+
+  if(IS_LOCAL_LABEL(label)) {  /* kept out of the symbol table, see resolve_label */
+    if(local_labels_cnt == local_labels_max) {
+      local_labels_max *= 2;
+      local_labels = realloc(local_labels, local_labels_max * sizeof(SymbolEntry_t));
+    }
+    local_labels[local_labels_cnt].name = label;
+    local_labels[local_labels_cnt].attr = attr;
+    local_labels[local_labels_cnt++].offset = offset;
+    return 0;
+  }
 
   /* label already exists in symbol table */
   if(NULL != ( symbolp = search_symbol(label))) {
-    free(label);
     if((symbolp->offset >= 0) && ((attr & SYM_CODE) || (attr & SYM_DATA))) {
       /* error - attempted label definition but label was already defined */
       error.errid = ELABEL_DOUBLE_DEF;
@@ -129,6 +280,7 @@ log_label(char *label, int attr, int line_ind)
   }
 
   if(error.errid != 0) {
+    PROBE4(label__conflict, filename, stm->line_ind, get_name(label), error.errid);
     print_error(error);
     error_occurred = 1;
   }
@@ -136,32 +288,399 @@ log_label(char *label, int attr, int line_ind)
 }
 
 
+/*
+ * Initializes the (empty) table of local labels.
+ * Discards previously logged local labels.
+ */
+static void
+init_local_labels()
+{
+  free(local_labels);
+  local_labels_cnt = 0;
+  local_labels_max = LOCAL_LABELS_INIT;
+  local_labels = malloc(local_labels_max * sizeof(SymbolEntry_t));
+}
+
+
+/*
+ * Comparison function between the ids of local labels.
+ */
+static int
+local_label_cmp(const void *label1, const void *label2)
+{
+  const SymbolEntry_t * const plabel1 = label1;
+  const SymbolEntry_t * const plabel2 = label2;
+  return (plabel1->name > plabel2->name) - (plabel1->name < plabel2->name);
+}
+
+
+/*
+ * Searches the label with the given id: a local label in the table of local labels
+ * (which must be sorted by then), or else a symbol in the symbol table.
+ * If found, returns a pointer to it, else returns NULL.
+ */
+static SymbolEntry_t*  /* pointer to the symbol if found */
+resolve_label(int label)
+{
+  SymbolEntry_t key;
+  if(!IS_LOCAL_LABEL(label))
+    return search_symbol(label);
+  key.name = label;
+  return bsearch(&key, local_labels, local_labels_cnt, sizeof(SymbolEntry_t), local_label_cmp);
+}
+
+
 /* 
- * Writes an instruction encoding into the instruction image and advances IC.
+ * Writes an instruction encoding into the instruction image.
  * inst_enc - the encoded instruction to write.
+ * ic       - offset of the instruction in the instruction image.
  */
 static void
-write_instruction(int32_t inst_enc)
+write_instruction(int32_t inst_enc, long ic)
 {
   int i=0;
   for(i=0; i<4; i++) {
-    inst_img[IC++] = (inst_enc >> 8*i) & 0xFF;
+    inst_img[ic+i] = (inst_enc >> 8*i) & 0xFF;
   }
 }
 
 
+/*
+ * Makes room for size more bytes of data after DC in the memory image,
+ * which is doubled as needed. The added bytes are zero-filled.
+ * If there's not enough memory, the image is left as is and -1 is returned.
+ */
+static int  /* nonzero on failure */
+reserve_memory(long size)
+{
+  long new_size = mem_img_size, end = mem_at(DC) - mem_img + size;
+  char *img;
+  if(end <= mem_img_size)
+    return 0;
+  while(end > new_size)
+    new_size *= 2;
+  if(NULL == (img = realloc(mem_img, new_size)))
+    return -1;
+  memset(&img[mem_img_size], 0, new_size - mem_img_size);
+  mem_img = img;
+  mem_img_size = new_size;
+  return 0;
+}
+
+
 /* 
  * Writes a chunk of data into the memory image and advances DC.
  * data  - pointer to the data that would be written.
  * count - number of data chunks to write.
  * size  - size of one chunk of data.
+ * Returns -1 if there's not enough memory for the data (see reserve_memory), else 0.
  */
-static void
+static int  /* nonzero on failure */
 write_memory(char *data, int count, int size)
 {
-  memcpy(&mem_img[DC], data, size*count);
+  if(!(options & OPT_CHECK)) {
+    if(0 != reserve_memory(size*count)) {
+      free(data);
+      return -1;
+    }
+    memcpy(mem_at(DC), data, size*count);
+  }
   DC += size*count;
   free(data);
+  return 0;
+}
+
+
+/*
+ * Discards the zero runs of the previous memory image.
+ */
+static void
+init_zero_runs()
+{
+  free(zero_runs);
+  zero_runs_cnt = 0;
+  zero_runs_max = ZERO_RUNS_INIT;
+  zero_runs = malloc(zero_runs_max * sizeof(struct zero_run));
+}
+
+
+/*
+ * Returns the index of the last zero run that starts at or before offset,
+ * or -1 if there's none.
+ */
+static int  /* index of the run */
+search_zero_run(long offset)
+{
+  int low = 0, high = zero_runs_cnt - 1, mid;
+  while(low <= high) {
+    mid = (low + high) / 2;
+    if(zero_runs[mid].offset <= offset)
+      low = mid + 1;
+    else
+      high = mid - 1;
+  }
+  return high;
+}
+
+
+/*
+ * Returns a pointer to the byte stored for offset in the memory image,
+ * i.e. the offset minus the length of the zero runs before it.
+ * Prerequisite: offset isn't within a zero run.
+ */
+static char*  /* pointer to the byte */
+mem_at(long offset)
+{
+  int i;
+  if(zero_runs_cnt == 0)
+    return &mem_img[offset];
+  i = search_zero_run(offset);
+  return &mem_img[offset - (i == -1 ? 0 : zero_runs[i].skipped)];
+}
+
+
+/*
+ * Returns the byte at offset in the memory image, expanding the zero runs.
+ */
+char  /* the byte */
+get_mem_byte(long offset)
+{
+  int i = search_zero_run(offset);
+  if(i == -1)
+    return mem_img[offset];
+  if(offset < zero_runs[i].offset + zero_runs[i].len)
+    return 0;
+  return mem_img[offset - zero_runs[i].skipped];
+}
+
+
+/*
+ * Returns the length of the chunk of the memory image that starts at offset and
+ * ends at the next zero run (or the end of the image), and sets *chunk to its stored
+ * bytes. If offset is within a zero run, the chunk is the rest of the run, and
+ * *chunk is set to NULL.
+ */
+long  /* length of the chunk */
+get_mem_chunk(long offset, const char **chunk)
+{
+  int i = search_zero_run(offset);
+  if(i != -1 && offset < zero_runs[i].offset + zero_runs[i].len) {
+    *chunk = NULL;
+    return zero_runs[i].offset + zero_runs[i].len - offset;
+  }
+  *chunk = &mem_img[offset - (i == -1 ? 0 : zero_runs[i].skipped)];
+  return (i + 1 < zero_runs_cnt ? zero_runs[i+1].offset : DCF) - offset;
+}
+
+
+/*
+ * Writes count chunks of size bytes, each holding value, into the memory image
+ * and advances DC.
+ * A long run of zeros is recorded as a zero run instead of being written.
+ * Returns -1 if there's not enough memory for the data (see reserve_memory), else 0.
+ */
+static int  /* nonzero on failure */
+fill_memory(long count, int size, long value)
+{
+  struct zero_run *last;
+  long len = count * size, i;
+  int j;
+  if(options & OPT_CHECK) {
+    DC += len;
+    return 0;
+  }
+  if(value == 0 && len >= ZERO_RUN_MIN) {
+    last = zero_runs_cnt > 0 ? &zero_runs[zero_runs_cnt - 1] : NULL;
+    if(last != NULL && last->offset + last->len == DC) {
+      /* extends the previous run */
+      last->len += len;
+      last->skipped += len;
+    } else {
+      if(zero_runs_cnt == zero_runs_max) {
+        zero_runs_max *= 2;
+        zero_runs = realloc(zero_runs, zero_runs_max * sizeof(struct zero_run));
+      }
+      zero_runs[zero_runs_cnt].offset = DC;
+      zero_runs[zero_runs_cnt].len = len;
+      zero_runs[zero_runs_cnt].skipped = len
+        + (zero_runs_cnt > 0 ? zero_runs[zero_runs_cnt - 1].skipped : 0);
+      zero_runs_cnt++;
+    }
+    DC += len;
+    return 0;
+  }
+  if(0 != reserve_memory(len))
+    return -1;
+  for(i=0; i<count; i++)
+    for(j=0; j<size; j++)
+      *mem_at(DC++) = (value >> 8*j) & 0xFF;
+  return 0;
+}
+
+
+/*
+ * Returns the alignment (in bytes) of the data of a directive statement:
+ * the argument of .align directives, and with --align-data,
+ * the natural alignment of .dh and .dw data.
+ */
+static int  /* the alignment */
+get_alignment(Statement_t stm)
+{
+  switch(stm.inst.di_inst.dirid) {
+    case DIR_ALIGN:
+      return stm.inst.di_inst.dir.Ndir.argv[0];
+    case DIR_DH:
+      return (options & OPT_ALIGN_DATA) ? 2 : 1;
+    case DIR_DW:
+      return (options & OPT_ALIGN_DATA) ? 4 : 1;
+    case DIR_FILL:
+      return (options & OPT_ALIGN_DATA) ? stm.inst.di_inst.dir.Ndir.argv[1] : 1;
+    default:
+      return 1;
+  }
+}
+
+
+/*
+ * Advances DC (zero padding the memory image) until the address
+ * of the next byte of data is a multiple of align.
+ * Returns -1 if there's not enough memory for the padding (see reserve_memory), else 0.
+ */
+static int  /* nonzero on failure */
+align_memory(int align)
+{
+  long pad = (data_base + DC) % align;
+  if(pad != 0) {
+    if(!(options & OPT_CHECK) && 0 != reserve_memory(align - pad))
+      return -1;
+    DC += align - pad;
+  }
+  return 0;
+}
+
+
+/*
+ * Checks that the data of the directive statement stm, along with the padding
+ * that aligns it, ends within the address space (see MAX_ADDRESS).
+ * The length of the file included by .incbin is checked once the file is opened.
+ * On failure, the error is printed, the payload of stm is freed and its id is returned.
+ */
+static int  /* error id - nonzero on failure */
+check_data_range(Statement_t stm)
+{
+  struct NtypeDir Ndir = stm.inst.di_inst.dir.Ndir;
+  long room = MAX_ADDRESS + 1 - (data_base + DC), align = get_alignment(stm), count, size = 1;
+  char *payload = get_payload(stm, &count);
+  if((data_base + DC) % align != 0)
+    room -= align - (data_base + DC) % align;
+  if(stm.inst.di_inst.dirid == DIR_SPACE) {
+    count = Ndir.argv[0];
+  } else if(stm.inst.di_inst.dirid == DIR_FILL) {
+    count = Ndir.argv[0];
+    size = Ndir.argv[1];
+  }
+  if(room >= 0 && count <= room / size)  /* count*size might overflow */
+    return 0;
+  free(payload);
+  report_data_error(stm, EDATA_RANGE);
+  return EDATA_RANGE;
+}
+
+
+/*
+ * Prints an error of writing the data of the directive statement stm.
+ */
+static void
+report_data_error(Statement_t stm, enum ErrId errid)
+{
+  Error_t error;
+  error.errid = errid;
+  error.line = error.call_line = NULL;
+  error.tok.ind = -1;
+  error.line_ind = stm.line_ind;
+  error.macro_line = stm.macro_line;
+  print_error(error);
+  error_occurred = 1;
+}
+
+
+/*
+ * Returns the path of a file included by the source file: unless path is
+ * absolute, it is relative to the directory of the source file.
+ * The returned path should be freed by the caller.
+ */
+static char*  /* the resolved path */
+resolve_path(const char *path)
+{
+  const char *slash = strrchr(filepath, '/');
+  long dirlen = (path[0] == '/' || slash == NULL) ? 0 : slash - filepath + 1;
+  char *resolved = malloc(dirlen + strlen(path) + 1);
+  memcpy(resolved, filepath, dirlen);
+  strcpy(&resolved[dirlen], path);
+  return resolved;
+}
+
+
+/*
+ * Writes the bytes of the file included by a .incbin directive into the memory image:
+ * the whole file, or length bytes starting at offset if they were given.
+ * The file is mapped into memory, so that its bytes are copied only once.
+ * On failure, the error is printed and its id is returned.
+ */
+static int  /* error id - nonzero on failure */
+include_binary(Statement_t stm)
+{
+  struct BtypeDir Bdir = stm.inst.di_inst.dir.Bdir;
+  struct stat st;
+  char *path = resolve_path(Bdir.path), *map;
+  long offset = 0, length;
+  int fd;
+  Error_t error;
+  error.errid = 0;
+  error.line = error.call_line = NULL;
+  error.tok.ind = -1;
+  error.line_ind = stm.line_ind;
+  error.macro_line = stm.macro_line;
+
+  fd = open(path, O_RDONLY);
+  free(path);
+  free(Bdir.path);
+  if(fd == -1 || fstat(fd, &st) == -1) {
+    error.errid = EINCBIN_READ;
+  } else {
+    length = st.st_size;
+    if(Bdir.argc == 2) {
+      offset = Bdir.argv[0];
+      length = Bdir.argv[1];
+    }
+    if(offset + length > st.st_size) {
+      error.errid = EINCBIN_RANGE;
+    } else if(length > MAX_ADDRESS + 1 - (data_base + DC)) {
+      error.errid = EDATA_RANGE;
+    } else if(options & OPT_CHECK) {
+      DC += length;
+    } else if(length > 0) {
+      map = mmap(NULL, offset + length, PROT_READ, MAP_PRIVATE, fd, 0);
+      if(map == MAP_FAILED) {
+        error.errid = EINCBIN_READ;
+      } else {
+        if(0 != reserve_memory(length)) {
+          error.errid = EDATA_MEMORY;
+        } else {
+          memcpy(mem_at(DC), &map[offset], length);
+          DC += length;
+        }
+        munmap(map, offset + length);
+      }
+    }
+  }
+  if(fd != -1)
+    close(fd);
+  if(error.errid != 0) {
+    print_error(error);
+    error_occurred = 1;
+  }
+  return error.errid;
 }
 
 
@@ -169,38 +688,117 @@ write_memory(char *data, int count, int size)
  * Performs a directive.
  * For .entry or .extern directives:
  *  Logs the label into the symbol table with tha appropriate attributes.
- * For .asciz, .db, .dh or .dw directives:
- *  Writes the data into the memory image.
+ * For .asciz, .db, .dh, .dw or .incbin directives:
+ *  Writes the data into the memory image (and records it for data merging).
+ * For .space or .fill directives:
+ *  Fills the memory image with zeros, or with the given value (see fill_memory).
+ * If there's not enough memory for the data, EDATA_MEMORY is printed.
  */
 static int  /* nonzero on failure */
 perform_directive(Statement_t stm)
 {
   Dir_t dir = stm.inst.di_inst.dir;
-  char *label = dir.Sdir.label;
+  int label = dir.Sdir.label, failed = 0;
+  long offset = DC;
   switch(stm.inst.di_inst.dirid) {
     case DIR_ENTRY:
-      return log_label(label, SYM_ENTRY, stm.line_ind);
+      return log_label(label, SYM_ENTRY, &stm);
     case DIR_EXTERN:
-      return log_label(label, SYM_EXTERN, stm.line_ind);
+      return log_label(label, SYM_EXTERN, &stm);
     case DIR_ASCIZ:
-      write_memory(dir.Sdir.str, strlen(dir.Sdir.str)+1, 1);
+      failed = write_memory(dir.Sdir.str, strlen(dir.Sdir.str)+1, 1);
       break;
     case DIR_DB:
-      write_memory(dir.Adir.argv, dir.Adir.argc, 1);
+      failed = write_memory(dir.Adir.argv, dir.Adir.argc, 1);
       break;
     case DIR_DH:
-      write_memory(dir.Adir.argv, dir.Adir.argc, 2);
+      failed = write_memory(dir.Adir.argv, dir.Adir.argc, 2);
       break;
     case DIR_DW:
-      write_memory(dir.Adir.argv, dir.Adir.argc, 4);
+      failed = write_memory(dir.Adir.argv, dir.Adir.argc, 4);
+      break;
+    case DIR_INCBIN:
+      include_binary(stm);
+      break;
+    case DIR_SPACE:
+      failed = fill_memory(dir.Ndir.argv[0], 1, 0);
+      break;
+    case DIR_FILL:
+      failed = fill_memory(dir.Ndir.argv[0], dir.Ndir.argv[1], dir.Ndir.argv[2]);
       break;
     default:
       break;
   }
+  if(failed) {
+    report_data_error(stm, EDATA_MEMORY);
+    return EDATA_MEMORY;
+  }
+  if(stm.inst.di_inst.dirid == DIR_SPACE || stm.inst.di_inst.dirid == DIR_FILL)
+    return 0;  /* fills aren't merged */
+  if((options & OPT_MERGE_DATA) && DC > offset)
+    record_data(offset, DC - offset, stm.inst.di_inst.dirid == DIR_ASCIZ);
   return 0;
 }
 
 
+/*
+ * Handles the label definition and directive of a single statement,
+ * as part of assembling the memory image and the symbol table.
+ * If mergeable is set, the data of the directive may be merged (see is_mergeable).
+ */
+static void
+scan_memory_stm(Statement_t stm, int mergeable)
+{
+  long offset, len;
+  Error_t warning;
+  warning.line = warning.call_line = NULL;
+  warning.tok.ind = -1;
+  warning.macro_line = stm.macro_line;
+  switch(stm.type) {
+    case STATEMENT_OPERATION:
+      if(stm.label != 0) /* statement contains label definition */
+        log_label(stm.label, SYM_CODE, &stm);
+      IC += 4;
+      break;
+    case STATEMENT_DIRECTIVE:
+      if(mergeable && -1 != (offset = search_payload(stm))) {
+        /* the payload was already written - alias the label to it */
+        log_label_at(stm.label, SYM_DATA, offset, &stm);
+        free(get_payload(stm, &len));
+        break;
+      }
+      /* the data (and its label) starts at the alignment of the directive,
+         and ends within the address space */
+      if(0 != check_data_range(stm))
+        break;
+      if(0 != align_memory(get_alignment(stm))) {
+        free(get_payload(stm, &len));
+        report_data_error(stm, EDATA_MEMORY);
+        break;
+      }
+      if(stm.label != 0) {
+        if(stm.inst.di_inst.dirid == DIR_ENTRY) {
+          warning.errid = WLABEL_DEF_ENTRY;
+          warning.line_ind = stm.line_ind;
+          print_error(warning);
+        }
+        else if(stm.inst.di_inst.dirid == DIR_EXTERN) {
+          warning.line_ind = stm.line_ind;
+          warning.errid = WLABEL_DEF_EXTERN;
+          print_error(warning);
+        }
+        else
+          log_label(stm.label, SYM_DATA, &stm);
+      }
+        /* statement contains label definition */
+      perform_directive(stm);
+    case STATEMENT_ERROR:
+    default:
+      break;
+  }
+}
+
+
 /* 
  * Scans the array of assembly statements and handles all directives
  * and label definitions. As a results, both the program's memory image
@@ -211,94 +809,294 @@ write_memory_image(Statement_t *statements)
 {
   int i;
   Statement_t stm = *statements;
-  Error_t warning;
-  warning.line = NULL;
-  warning.tok.ind = -1;
-  for(i=1; stm.type != STATEMENT_END; stm = statements[i++]) {
-    switch(stm.type) {
-      case STATEMENT_OPERATION:
-        if(stm.label != NULL) /* statement contains label definition */
-          log_label(stm.label, SYM_CODE, stm.line_ind);
-        IC += 4;
-        break;
-      case STATEMENT_DIRECTIVE:
-        if(stm.label != NULL) {
-          if(stm.inst.di_inst.dirid == DIR_ENTRY) {
-            free(stm.label);
-            warning.errid = WLABEL_DEF_ENTRY;
-            warning.line_ind = stm.line_ind;
-            print_error(warning);
-          }
-          else if(stm.inst.di_inst.dirid == DIR_EXTERN) {
-            free(stm.label);
-            warning.line_ind = stm.line_ind;
-            warning.errid = WLABEL_DEF_EXTERN;
-            print_error(warning);
-          }
-          else
-            log_label(stm.label, SYM_DATA, stm.line_ind);
-        }
-          /* statement contains label definition */
-        perform_directive(stm);
-      case STATEMENT_ERROR:
-      default:
-        break;
+  /* the data image is loaded right after the instruction image */
+  data_base = INITIAL_IC;
+  for(stm = *statements, i=1; stm.type != STATEMENT_END; stm = statements[i++])
+    if(stm.type == STATEMENT_OPERATION) data_base += 4;
+  stm = *statements;
+  PROBE2(phase__start, "memory", filename);
+  init_zero_runs();
+  init_local_labels();
+  if(options & OPT_MERGE_DATA)
+    init_data_table();
+  for(i=1; stm.type != STATEMENT_END; stm = statements[i++])
+    scan_memory_stm(stm, (options & OPT_MERGE_DATA) && stm.label != 0
+                         && stm.type == STATEMENT_DIRECTIVE && is_mergeable(statements, i-1));
+  if(options & OPT_MERGE_DATA)
+    cleanup_data_table();
+  qsort(local_labels, local_labels_cnt, sizeof(SymbolEntry_t), local_label_cmp);
+  PROBE3(phase__done, "memory", filename, DC);
+}
+
+
+/*
+ * Handles a single operation statement, as part of assembling the instruction image:
+ * resolves the label it references and writes its encoding at the IC of job.
+ * References and errors are collected by job (see finish_job).
+ * Prerequisite: the symbol table should be assembled beforehand.
+ */
+static void
+scan_instruction_stm(Statement_t stm, struct job *job)
+{
+  Op_t *op = &stm.inst.op_inst.op;
+  Error_t error;
+  error.errid = 0;
+  error.line = error.call_line = NULL;
+  error.tok.ind = -1;
+  if(stm.type != STATEMENT_OPERATION)
+    return;
+  /* set label adderss for operations that require labels */
+  switch(stm.inst.op_inst.opcode) {
+    case OP_BNE:
+    case OP_BEQ:
+    case OP_BGT:
+    case OP_BLT:
+      error.errid = handle_branch_op(op, job);
+      break;
+    case OP_LA:
+      error.errid = handle_la_op(op, job);
+      break;
+    case OP_JMP:
+    case OP_CALL:
+      error.errid = handle_jmp_op(op, job);
+    default:
+      break;
+  }
+  if(error.errid != 0) {
+    error.line_ind = stm.line_ind;
+    error.macro_line = stm.macro_line;
+    add_job_error(job, error);
+  }
+  if(!(options & OPT_CHECK))
+    write_instruction(encode_op_stm(stm.inst.op_inst), job->ic);
+  job->ic += 4;
+}
+
+
+/*
+ * Initializes a job whose range starts at first, and whose first instruction is at ic.
+ */
+static void
+init_job(struct job *job, Statement_t *first, long ic)
+{
+  job->first = job->last = first;
+  job->ic = ic;
+  job->refs_cnt = job->errors_cnt = 0;
+  job->refs_max = job->errors_max = 16;
+  job->refs = malloc(job->refs_max * sizeof(SymbolEntry_t));
+  job->errors = malloc(job->errors_max * sizeof(Error_t));
+}
+
+
+/*
+ * Appends a reference to a symbol (a SYM_REQUIRED symbol entry) to the references of job.
+ * References to local labels are dropped, as they never enter the symbol table.
+ */
+static void
+add_reference(struct job *job, SymbolEntry_t symbol)
+{
+  if(IS_LOCAL_LABEL(symbol.name))
+    return;
+  if(job->refs_cnt == job->refs_max) {
+    job->refs_max *= 2;
+    job->refs = realloc(job->refs, job->refs_max * sizeof(SymbolEntry_t));
+  }
+  job->refs[job->refs_cnt++] = symbol;
+}
+
+
+/*
+ * Appends an error (or warning) to the errors of job.
+ */
+static void
+add_job_error(struct job *job, Error_t error)
+{
+  if(job->errors_cnt == job->errors_max) {
+    job->errors_max *= 2;
+    job->errors = realloc(job->errors, job->errors_max * sizeof(Error_t));
+  }
+  job->errors[job->errors_cnt++] = error;
+}
+
+
+/*
+ * Encodes the operations in the range of a job.
+ * Runs as the start routine of a thread, hence the void pointers.
+ */
+static void*  /* always NULL */
+run_job(void *job)
+{
+  struct job *jobp = job;
+  Statement_t *stm;
+  for(stm = jobp->first; stm != jobp->last; stm++)
+    scan_instruction_stm(*stm, jobp);
+  return NULL;
+}
+
+
+/*
+ * Adds the references collected by job to the symbol table, prints its errors
+ * (setting error_occurred if any of them isn't a warning), and frees it up.
+ * Finishing the jobs in order of their ranges keeps the symbol table (and with it,
+ * the .ext file) the same as encoding all operations in a single job.
+ */
+static void
+finish_job(struct job *job)
+{
+  int i;
+  for(i=0; i<job->refs_cnt; i++)
+    add_symbol(job->refs[i]);
+  for(i=0; i<job->errors_cnt; i++) {
+    print_error(job->errors[i]);
+    if(job->errors[i].errid < ___WARNINGS___)  /* errid is not a warning */
+      error_occurred = 1;
+  }
+  IC = job->ic;
+  free(job->refs);
+  free(job->errors);
+}
+
+
+/*
+ * Splits the array of statements into up to jobs ranges (see --jobs), with a similar
+ * count of operations in each, and initializes a job for each range.
+ * A job encodes no less than JOB_MIN_OPS operations, as smaller jobs aren't worth a thread.
+ * Returns the count of jobs.
+ */
+static int  /* count of jobs */
+split_jobs(Statement_t *statements, struct job *job_list)
+{
+  long ops = ICF / 4, per_job, job_ops = 0;
+  int cnt = ops / JOB_MIN_OPS < jobs ? ops / JOB_MIN_OPS : jobs;
+  Statement_t *stm;
+  if(cnt < 1)
+    cnt = 1;
+  per_job = (ops + cnt - 1) / cnt;
+  cnt = 0;
+  init_job(&job_list[cnt++], statements, 0);
+  for(stm = statements; stm->type != STATEMENT_END; stm++) {
+    if(stm->type != STATEMENT_OPERATION)
+      continue;
+    if(job_ops++ == per_job) {  /* the range of the current job is full */
+      job_list[cnt-1].last = stm;
+      init_job(&job_list[cnt], stm, job_list[cnt-1].ic + per_job*4);
+      cnt++;
+      job_ops = 1;
     }
   }
+  job_list[cnt-1].last = stm;
+  return cnt;
 }
 
 
 /*
  * Scans the array of assembly statements and handles all operations.
  * As a results, the program's instruction image is completed.
+ * With --jobs, ranges of the operations are encoded in parallel (see split_jobs).
  * Prerequisite: the symbol table should be assembled beforehand.
  */
 void
 write_instruction_image(Statement_t *statements)
 {
-  int i;
-  int32_t inst_enc;  /* instruction encoding */
-  Statement_t stm = *statements;
-  Op_t *op;
+  struct job job_list[MAX_JOBS];
+  pthread_t threads[MAX_JOBS];
+  int created[MAX_JOBS];
+  int i, cnt;
   Error_t error;
   error.errid = 0;
-  error.line = NULL;
+  error.line = error.call_line = NULL;
   error.tok.ind = -1;
-  for(i=1; stm.type != STATEMENT_END; stm = statements[i++]) {
-    op = &stm.inst.op_inst.op;
-    if(stm.type == STATEMENT_OPERATION) {
-      /* set label adderss for operations that require labels */
-      switch(stm.inst.op_inst.opcode) {
-        case OP_BNE:
-        case OP_BEQ:
-        case OP_BGT:
-        case OP_BLT:
-          error.errid = handle_branch_op(op);
-          break;
-        case OP_LA:
-          error.errid = handle_la_op(op);
-          break;
-        case OP_JMP:
-        case OP_CALL:
-          error.errid = handle_jmp_op(op);
-        default:
-          break;
-      }
-      if(error.errid != 0) {
-        error.line_ind = stm.line_ind;
-        print_error(error);
-        error.errid = 0;
-      }
-      inst_enc = encode_op_stm(stm.inst.op_inst);
-      write_instruction(inst_enc);
-    }
+  error.macro_line = 0;
+  PROBE2(phase__start, "instruction", filename);
+  cnt = split_jobs(statements, job_list);
+  for(i=1; i<cnt; i++)
+    created[i] = 0 == pthread_create(&threads[i], NULL, run_job, &job_list[i]);
+  run_job(&job_list[0]);
+  for(i=1; i<cnt; i++) {
+    if(created[i])
+      pthread_join(threads[i], NULL);
+    else  /* no thread - encode the range here */
+      run_job(&job_list[i]);
   }
+  for(i=0; i<cnt; i++)
+    finish_job(&job_list[i]);
   /* iterate over symbol table and check for  */
   check_symtable_integrity(&error);
   if(error.errid != 0 && error.errid < ___WARNINGS___)  /* errid is not a warning */
     error_occurred = 1;
+  PROBE3(phase__done, "instruction", filename, ICF);
 }
 
+
+/*
+ * Assembles the symbol table and the memory & instruction images by streaming
+ * the source file, instead of parsing it into an array of statements (--low-memory).
+ * Each statement is freed as soon as it was handled, so the memory used grows
+ * with the count of symbols rather than with the count of lines.
+ * The file is parsed three times:
+ *  1. counts the operations, which determines the address the memory image is loaded at,
+ *     and records their layout for relaxing the branches (see "relax.c").
+ *  2. handles label definitions and directives, as write_memory_image does.
+ *  3. handles operations, as write_instruction_image does.
+ * The last two passes relax each statement before handling it.
+ * Syntax errors are reported by the first pass only.
+ * Sets ICF & DCF.
+ * Prerequisite: source must be seekable.
+ */
+void
+write_images_streamed(FILE *source)
+{
+  Statement_t stm, seq[RELAX_MAX_STMS];
+  struct job job;
+  int line_ind, i, cnt;
+  Error_t error;
+  error.errid = 0;
+  error.line = error.call_line = NULL;
+  error.tok.ind = -1;
+  error.macro_line = 0;
+
+  PROBE2(phase__start, "streamed", filename);
+  data_base = INITIAL_IC;
+  init_layout();
+  for(line_ind=1; parse_next_statement(source, &stm, line_ind, 1); line_ind++) {
+    if(stm.type == STATEMENT_OPERATION) data_base += 4;
+    add_layout_stm(stm);
+    free_statement(stm);
+  }
+  data_base += solve_layout();
+
+  rewind(source);
+  init_zero_runs();
+  init_local_labels();
+  for(line_ind=1; parse_next_statement(source, &stm, line_ind, 0); line_ind++) {
+    cnt = relax_stm(stm, seq);
+    for(i=0; i<cnt; i++)
+      scan_memory_stm(seq[i], 0);  /* consumes the data of the statement */
+  }
+  qsort(local_labels, local_labels_cnt, sizeof(SymbolEntry_t), local_label_cmp);
+  ICF = IC; DCF = DC;
+  IC = 0; DC = 0;
+  if(!(options & OPT_CHECK))
+    inst_img = calloc(ICF + 1, sizeof(char));
+
+  rewind(source);
+  init_job(&job, NULL, 0);
+  rewind_layout();
+  for(line_ind=1; parse_next_statement(source, &stm, line_ind, 0); line_ind++) {
+    cnt = relax_stm(stm, seq);
+    for(i=0; i<cnt; i++)
+      scan_instruction_stm(seq[i], &job);
+    free_statement(stm);
+  }
+  finish_job(&job);
+  cleanup_layout();
+  check_symtable_integrity(&error);
+  if(error.errid != 0 && error.errid < ___WARNINGS___)  /* errid is not a warning */
+    error_occurred = 1;
+  PROBE3(phase__done, "streamed", filename, line_ind - 1);
+}
+
+
 /*
  * Iterates over the symbol table in search of symbols that were declared 
  * an entry but never defined - prints an error message for each.
@@ -322,19 +1120,22 @@ check_symtable_integrity(Error_t *error)
 
 /*
  * Handles symbol refrences that are part of branch operations (bne, beq, bgt, blt).
+ * A branch without a label was relaxed (see "relax.c"), and its offset is already set.
+ * Returns EBRANCH_RANGE if the offset of the label doesn't fit the immed field.
  */
 static int  /* error id - nonzero on failure */
-handle_branch_op(Op_t *op)
+handle_branch_op(Op_t *op, struct job *job)
 {
   enum ErrId errid = 0;
   SymbolEntry_t *symbolp, symbol_req;
-  symbolp = search_symbol(op->Iop.label);
+  long offset;
+  if(op->Iop.label == 0)
+    return 0;
+  symbolp = resolve_label(op->Iop.label);
   if (symbolp == NULL) {
     /* error - undefined label */
-    free(op->Iop.label);
     return ELABEL_UNDEFINED;
   } else if(symbolp->attr & SYM_EXTERN) {
-    free(op->Iop.label);
     return ELABEL_UNEXP_EXT;
   } else {
     if(symbolp->attr & SYM_DATA) {
@@ -342,13 +1143,16 @@ handle_branch_op(Op_t *op)
       errid = WLABEL_JMP2DATA;
     }
     if(symbolp->attr & SYM_DATA)
-      op->Iop.immed = symbolp->offset - IC + ICF;
+      offset = symbolp->offset - job->ic + ICF;
     else
-      op->Iop.immed = symbolp->offset - IC;
+      offset = symbolp->offset - job->ic;
+    if(!IN_BOUNDS(offset, 16))
+      errid = EBRANCH_RANGE;
+    op->Iop.immed = offset;
     symbol_req.name = op->Iop.label;
     symbol_req.attr = symbolp->attr | SYM_REQUIRED;
-    symbol_req.offset = IC;
-    add_symbol(symbol_req);
+    symbol_req.offset = job->ic;
+    add_reference(job, symbol_req);
   }
   return errid;
 }
@@ -358,28 +1162,26 @@ handle_branch_op(Op_t *op)
  * Handles symbol refrences that are part of a load adress (la) operation.
  */
 static int  /* error id - nonzero on failure */
-handle_la_op(Op_t *op)
+handle_la_op(Op_t *op, struct job *job)
 {
   SymbolEntry_t *symbol, symbol_req;
-  if(op->Jop.label == NULL) {
+  if(op->Jop.label == 0) {
     return 0;
   }
-  symbol = search_symbol(op->Jop.label);
+  symbol = resolve_label(op->Jop.label);
   if (symbol == NULL) {
     /* error - undefined label */
-    free(op->Jop.label);
     return ELABEL_UNDEFINED;
   } else if (!(symbol->attr & SYM_EXTERN) && !(symbol->attr & SYM_DATA)) {
     /* error - expected a data symbol */
-    free(op->Jop.label);
     return ELABEL_EXP_DATA;
   }
   else {
     op->Jop.addr = symbol->attr & SYM_EXTERN ? 0 : symbol->offset + ICF + INITIAL_IC;
     symbol_req.name = op->Jop.label;
     symbol_req.attr = symbol->attr | SYM_REQUIRED;
-    symbol_req.offset = IC;
-    add_symbol(symbol_req);
+    symbol_req.offset = job->ic;
+    add_reference(job, symbol_req);
   }
   return 0;
 }
@@ -388,17 +1190,16 @@ handle_la_op(Op_t *op)
  * Handles symbol refrences that are part of a jmp/call operation.
  */
 static int  /* error id - nonzero on failure */
-handle_jmp_op(Op_t *op)
+handle_jmp_op(Op_t *op, struct job *job)
 {
   enum ErrId errid = 0;
   SymbolEntry_t *symbolp, symbol_req;
-  if(op->Jop.label == NULL) {
+  if(op->Jop.label == 0) {
     return 0;
   }
-  symbolp = search_symbol(op->Jop.label);
+  symbolp = resolve_label(op->Jop.label);
   if (symbolp == NULL) {
     /* error - undefined label */
-    free(op->Jop.label);
     return ELABEL_UNDEFINED;
   } else {
     if((symbolp->attr & SYM_DATA)) {
@@ -413,8 +1214,196 @@ handle_jmp_op(Op_t *op)
       op->Jop.addr = symbolp->offset + INITIAL_IC;
     symbol_req.name = op->Jop.label;
     symbol_req.attr = symbolp->attr | SYM_REQUIRED;
-    symbol_req.offset = IC;
-    add_symbol(symbol_req);
+    symbol_req.offset = job->ic;
+    add_reference(job, symbol_req);
   }
   return errid;
 }
+
+
+/* ===== Data merging ===================================== */
+
+/*
+ * Returns the FNV-1a hash of len bytes of data.
+ */
+static uint32_t  /* the hash */
+hash_data(const char *data, long len)
+{
+  uint32_t hash = 2166136261UL;
+  long i;
+  for(i=0; i<len; i++) {
+    hash ^= (unsigned char)data[i];
+    hash *= 16777619UL;
+  }
+  return hash;
+}
+
+
+/*
+ * Initializes the data hash table.
+ * Discards previously recorded payloads.
+ */
+static void
+init_data_table()
+{
+  int i;
+  data_entries_cnt = 0;
+  data_entries_max = DATA_BUCKETS_INIT;
+  data_entries = malloc(data_entries_max * sizeof(struct data_entry));
+  data_buckets_cnt = DATA_BUCKETS_INIT;
+  data_buckets = malloc(data_buckets_cnt * sizeof(int));
+  for(i=0; i<data_buckets_cnt; i++)
+    data_buckets[i] = -1;
+}
+
+
+/*
+ * Frees up all memory used by the data hash table.
+ */
+static void
+cleanup_data_table()
+{
+  free(data_entries);
+  free(data_buckets);
+}
+
+
+/*
+ * Records the len bytes at offset in the memory image in the data hash table.
+ * The count of buckets is doubled whenever the table gets full, keeping the
+ * bucket chains short.
+ */
+static void
+add_data_entry(long offset, long len)
+{
+  struct data_entry *entry;
+  int i, bucket;
+  if(data_entries_cnt == data_entries_max) {
+    data_entries_max *= 2;
+    data_entries = realloc(data_entries, data_entries_max * sizeof(struct data_entry));
+    data_buckets_cnt *= 2;
+    data_buckets = realloc(data_buckets, data_buckets_cnt * sizeof(int));
+    for(i=0; i<data_buckets_cnt; i++)
+      data_buckets[i] = -1;
+    for(i=0; i<data_entries_cnt; i++) {  /* rehash */
+      bucket = data_entries[i].hash & (data_buckets_cnt - 1);
+      data_entries[i].next = data_buckets[bucket];
+      data_buckets[bucket] = i;
+    }
+  }
+  entry = &data_entries[data_entries_cnt];
+  entry->hash = hash_data(mem_at(offset), len);
+  entry->offset = offset;
+  entry->len = len;
+  bucket = entry->hash & (data_buckets_cnt - 1);
+  entry->next = data_buckets[bucket];
+  data_buckets[bucket] = data_entries_cnt++;
+}
+
+
+/*
+ * Records a payload of len bytes that was written at offset in the memory image.
+ * If is_string is set, every suffix of the (null-terminated) string
+ * is recorded as well, so that equal string tails can be shared.
+ */
+static void
+record_data(long offset, long len, int is_string)
+{
+  long i;
+  add_data_entry(offset, len);
+  for(i=1; is_string && i<len; i++)
+    add_data_entry(offset + i, len - i);
+}
+
+
+/*
+ * Searches the data hash table for a payload equal to the len bytes of data,
+ * whose address is a multiple of align.
+ * If found - returns its offset in the memory image, else returns -1.
+ */
+static long  /* offset of the equal payload */
+search_data(const char *data, long len, int align)
+{
+  uint32_t hash = hash_data(data, len);
+  int i;
+  for(i = data_buckets[hash & (data_buckets_cnt - 1)]; i != -1; i = data_entries[i].next) {
+    if(data_entries[i].hash == hash && data_entries[i].len == len
+      && (data_base + data_entries[i].offset) % align == 0
+      && 0 == memcmp(mem_at(data_entries[i].offset), data, len))
+      return data_entries[i].offset;
+  }
+  return -1;
+}
+
+
+/*
+ * Returns the payload of a .asciz, .db, .dh or .dw directive statement
+ * and stores its length (in bytes) in len.
+ * For other statements, NULL is returned.
+ */
+static char*  /* the payload */
+get_payload(Statement_t stm, long *len)
+{
+  Dir_t dir = stm.inst.di_inst.dir;
+  *len = 0;
+  switch(stm.inst.di_inst.dirid) {
+    case DIR_ASCIZ:
+      *len = strlen(dir.Sdir.str) + 1;
+      return dir.Sdir.str;
+    case DIR_DB:
+      *len = dir.Adir.argc;
+      return dir.Adir.argv;
+    case DIR_DH:
+      *len = dir.Adir.argc * 2;
+      return dir.Adir.argv;
+    case DIR_DW:
+      *len = dir.Adir.argc * 4;
+      return dir.Adir.argv;
+    default:
+      return NULL;
+  }
+}
+
+
+/*
+ * Searches the data hash table for the payload of the directive statement stm,
+ * if found - returns its offset in the memory image, else returns -1.
+ */
+static long  /* offset of the equal payload */
+search_payload(Statement_t stm)
+{
+  long len;
+  char *data = get_payload(stm, &len);
+  if(data == NULL)
+    return -1;
+  return search_data(data, len, get_alignment(stm));
+}
+
+
+/*
+ * Determines whether the data directive at statements[i] may be merged, i.e. whether
+ * it isn't followed by an unlabelled data directive - which continues its data
+ * and therefore must remain right after it.
+ */
+static int  /* 1 iff mergeable */
+is_mergeable(Statement_t *statements, int i)
+{
+  Statement_t *stm;
+  for(stm = &statements[i+1]; stm->type != STATEMENT_END; stm++) {
+    if(stm->type != STATEMENT_DIRECTIVE)
+      continue;
+    switch(stm->inst.di_inst.dirid) {
+      case DIR_ASCIZ:
+      case DIR_DB:
+      case DIR_DH:
+      case DIR_DW:
+      case DIR_INCBIN:
+      case DIR_SPACE:
+      case DIR_FILL:
+        return stm->label != 0;
+      default:
+        break;
+    }
+  }
+  return 1;
+}
@@ -1,6 +1,9 @@
 /* ===== scan.h ===========================================
  * Header file for "scan.c".
- * Exposes the main functions: write_memory_image & write_instruction_image.
+ * Exposes the main functions: write_memory_image & write_instruction_image,
+ * and write_images_streamed which does both while streaming the source file,
+ * get_mem_byte & get_mem_chunk which read the assembled memory image,
+ * and encode_op_stm which encodes a single operation.
  */
 #ifndef SCAN_H
 #define SCAN_H
@@ -11,6 +14,10 @@
 
 void write_memory_image(Statement_t *statements);
 int write_instruction_image(Statement_t *statements);
+void write_images_streamed(FILE *source);
+char get_mem_byte(long offset);
+long get_mem_chunk(long offset, const char **chunk);
+int32_t encode_op_stm(OpInstruction_t op_inst);
 
 
 #endif
@@ -6,12 +6,15 @@
  * 2. directives - A static array of directive names and ids, used during tokenization
  *                 to match directive names to their id.
  * 3. symtable   - A dynamic array of symbols. Used during assembling to match
- *                 labels to addresses.
+ *                 labels to addresses. Symbols are identified by the id of their
+ *                 interned name, which also indexes the defined symbols directly.
  */
 /* ===== Includes ========================================= */
 #include <stdlib.h>
 #include <string.h>
 #include "tables.h"
+#include "intern.h"
+#include "probes.h"
 #include "types.h"
 #include "consts.h"
 
@@ -25,7 +28,7 @@ int search_op(char *term);
 int search_dir(char *term);
 void init_symtable();
 void add_symbol(SymbolEntry_t symbol);
-SymbolEntry_t* search_symbol(char *name);
+SymbolEntry_t* search_symbol(int name);
 
 static int op_cmp(const void *op1, const void *op2);
 static int dir_cmp(const void *dir1, const void *dir2);
@@ -50,6 +53,7 @@ struct op {
   {"la",    OP_LA},
   {"lb",    OP_LB},
   {"lh",    OP_LH},
+  {"li",    OP_LI},
   {"lw",    OP_LW},
   {"move",  OP_MOVE},
   {"mvhi",  OP_MVHI},
@@ -97,12 +101,16 @@ struct dir {
   char *name;
   enum DirId id;
 } directives[] = {  /* sorted for efficient searching */
+  {"align",  DIR_ALIGN},
   {"asciz",  DIR_ASCIZ},
   {"db",     DIR_DB},
   {"dh",     DIR_DH},
   {"dw",     DIR_DW},
   {"entry",  DIR_ENTRY},
-  {"extern", DIR_EXTERN}
+  {"extern", DIR_EXTERN},
+  {"fill",   DIR_FILL},
+  {"incbin", DIR_INCBIN},
+  {"space",  DIR_SPACE}
 };
 
 /*
@@ -135,6 +143,9 @@ search_dir(char *term)
 static int symtable_maxsize;
 SymbolEntry_t *symtable = NULL;
 int symtable_size;
+/* index in symtable of the (non-required) symbol of each name id, or -1 */
+static int *symindex = NULL;
+static int symindex_size;
 
 /*
  * Initializes the symbol table.
@@ -146,46 +157,58 @@ init_symtable()
   symtable_maxsize = 2;
   symtable_size = 0;
   symtable = calloc(symtable_maxsize , sizeof(SymbolEntry_t));
+  symindex_size = 0;
 }
 
 /*
- * Frees up all memory used by the symbol table and symbols in it.
+ * Frees up all memory used by the symbol table.
+ * The names of the symbols are owned by the interner (see "intern.c").
  */
 void
 cleanup_symtable()
 {
-  int i;
-  for(i=0; i<symtable_size; i++) {
-    free(symtable[i].name);
-  }
   free(symtable);
+  free(symindex);
+  symindex = NULL;
 }
 
 /*
  * Adds a symbol to the symbol table.
+ * Unless the symbol is a reference (SYM_REQUIRED), it is indexed by its name id.
  */
 void
 add_symbol(SymbolEntry_t symbol)
 {
+  int i;
   if(symtable_size == symtable_maxsize) {
     symtable_maxsize *= 2;
     symtable = realloc(symtable, symtable_maxsize * sizeof(SymbolEntry_t));
   }
+  if(!(symbol.attr & SYM_REQUIRED)) {
+    if(symbol.name >= symindex_size) {
+      i = symindex_size;
+      symindex_size = symbol.name >= 2*symindex_size ? symbol.name + 1 : 2*symindex_size;
+      symindex = realloc(symindex, symindex_size * sizeof(int));
+      for(; i<symindex_size; i++)
+        symindex[i] = -1;
+    }
+    symindex[symbol.name] = symtable_size;
+  }
   symtable[symtable_size++] = symbol;
+  PROBE3(symbol__add, get_name(symbol.name), symbol.attr, symtable_size);
 }
 
 /*
- * Searches the given symbol name in the symbols table,
+ * Searches the given symbol name id in the symbols table,
  * If found, returnes a pointer to it, else returns NULL.
  */
 SymbolEntry_t*  /* pointer to the symbol if found */
-search_symbol(char *name)
+search_symbol(int name)
 {
-  int i;
-  for(i=0; i<symtable_size; i++) {
-    if(!(symtable[i].attr & SYM_REQUIRED)  && (strcmp(symtable[i].name, name) == 0)) {
-      return &symtable[i];
-    }
+  if(name >= symindex_size || symindex[name] == -1) {
+    PROBE1(symbol__miss, get_name(name));
+    return NULL;
   }
-  return NULL;
+  PROBE2(symbol__hit, get_name(name), symindex[name]);
+  return &symtable[symindex[name]];
 }
@@ -19,14 +19,14 @@
 #define SYM_DATA     (1 << 4)  /* symbol is defined at a directive statement              */
 
 typedef struct SymbolEntry {
-  char *name;
+  int name;       /* id of the symbol's name (see "intern.c") */
   int32_t offset;
   int attr;       /* bitwise-OR of SYM_DATA, SYM_CODE, SYM_ENTRY, SYM_EXTERN, SYM_REQUIRED */
 } SymbolEntry_t;
 void init_symtable();
 void cleanup_symtable();
 void add_symbol(SymbolEntry_t symbol);
-SymbolEntry_t* search_symbol(char *name);
+SymbolEntry_t* search_symbol(int name);
 
 int search_op(char *tok);
 int search_dir(char *tok);
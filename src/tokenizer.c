@@ -15,6 +15,7 @@
 #include <string.h>
 #include <ctype.h>
 #include "tables.h"
+#include "intern.h"
 #include "types.h"
 #include "consts.h"
 
@@ -25,9 +26,16 @@
 
 /* ===== Declarations ===================================== */
 static long expect;
+static int local_last[LOCAL_LABELS_CNT];  /* id of the last definition of each local label, or 0 */
+static int local_next[LOCAL_LABELS_CNT];  /* id of the next definition of each local label,
+                                             if already referenced forward, or 0 */
+static int local_ids;   /* count of ids of local labels handed out so far, see local_label_id */
+static int templating;  /* 1 while tokenizing the body of a macro, see set_templating */
+static char *next;  /* the rest of the line, see next_token */
 
 /* ----- prototypes --------------------------------------- */
 Token_t next_token(char *line);
+int next_immed_array(int *values, int max, int bits);
 static Token_t tokenize_term(char *term);
 static char *  next_term(char *line);
 static char * next_string(char *line);
@@ -43,6 +51,8 @@ static int tokenize_immed(char *term, TokVal_t *tokval);
 static int is_string(char *term);
 static int is_label(char *term);
 static int is_labeldef(char *term);
+static int parse_local_term(char *term, char suffix);
+static int local_label_id(int num, char suffix);
 static int parse_reg_term(char *term);
 
 
@@ -50,6 +60,9 @@ static int parse_reg_term(char *term);
 /* expect values, see flags handling of next_term */
 #define EXP_STRING  (1)
 #define EXP_ARRAY   (2)
+/* id of an unresolved local label term of a macro body, see resolve_local_label */
+#define LOCAL_TERM_ID(num, kind) (-((num) * 3 + (kind) + 1))
+#define LOCAL_SUFFIXES ":bf"  /* suffixes of local label terms, by kind */
 
 /* ===== Code ============================================= */
 
@@ -96,7 +109,9 @@ tokenize_dir(char *term, TokVal_t *tokval)
   tokval->dirid = dirid;
   if(dirid == DIR_ASCIZ) {
     expect = EXP_STRING;
-  } else if(dirid == DIR_DB || dirid == DIR_DW || dirid == DIR_DH) {
+  } else if(dirid == DIR_DB || dirid == DIR_DW || dirid == DIR_DH
+         || dirid == DIR_INCBIN     /* .incbin "file", offset, length */
+         || dirid == DIR_FILL) {    /* .fill count, size, value */
     expect = EXP_ARRAY;
   }
   return 0;
@@ -125,40 +140,121 @@ tokenize_string(char *term, TokVal_t *tokval)
 
 /*
  * Attempts to process the term as a labeldef token,
- * on success updates tokval with the label string and returns 0.
+ * on success updates tokval with the id of the (interned) label and returns 0.
+ * A local label definition ("1:") is given an id of its own
+ * (see local_label_id), and is never interned.
  * On failure tokval is not modified and -1 is returned.
  */
 static int  /* nonzero on failure */
 tokenize_labeldef(char *term, TokVal_t *tokval)
 {
-  int len = strlen(term);
+  int num;
+  if (-1 != (num = parse_local_term(term, ':'))) {
+    tokval->label = local_label_id(num, ':');
+    return 0;
+  }
   if (!is_labeldef(term)) {
     return -1;
   }
-  tokval->label = malloc(len);
-  strncpy(tokval->label, term, len-1);
-  tokval->label[len-1] = '\0';
+  tokval->label = intern(term, strlen(term)-1);  /* without the ':' */
   return 0;
 }
 
 
 /*
  * Attempts to process the term as a label token,
- * on success updates tokval with the label string and returns 0.
+ * on success updates tokval with the id of the (interned) label and returns 0.
+ * A local label reference is resolved to the id of the definition it refers to:
+ * "1b" to the last definition of 1 so far (possibly on the same line),
+ * "1f" to the next one.
  * On failure tokval is not modified and -1 is returned.
  */
 static int  /* nonzero on failure */
 tokenize_label(char *term, TokVal_t *tokval)
 {
+  int num;
+  if (-1 != (num = parse_local_term(term, 'b'))) {
+    tokval->label = local_label_id(num, 'b');
+    return 0;
+  }
+  if (-1 != (num = parse_local_term(term, 'f'))) {
+    tokval->label = local_label_id(num, 'f');
+    return 0;
+  }
   if (!is_label(term)) {
     return -1;
   }
-  tokval->label = malloc(strlen(term)+1);
-  strcpy(tokval->label, term);
+  tokval->label = intern(term, strlen(term));
   return 0;
 }
 
 
+/*
+ * Returns the id of the local label term with the given number and suffix
+ * (':' for a definition, 'b' or 'f' for a reference).
+ * The definitions are given sequential ids (see LOCAL_LABEL_ID) in order of the pass,
+ * except for a definition referenced forward beforehand, which takes the id its
+ * references were given. A backward reference to a local label that isn't defined
+ * yet is given an id no definition takes.
+ * While templating, the term is left unresolved (see resolve_local_label).
+ */
+static int  /* the id of the label */
+local_label_id(int num, char suffix)
+{
+  int id;
+  if(templating)
+    return LOCAL_TERM_ID(num, strchr(LOCAL_SUFFIXES, suffix) - LOCAL_SUFFIXES);
+  if(suffix == 'b')
+    return local_last[num] != 0 ? local_last[num] : LOCAL_LABEL_ID(local_ids++);
+  id = local_next[num] != 0 ? local_next[num] : LOCAL_LABEL_ID(local_ids++);
+  if(suffix == 'f') {
+    local_next[num] = id;
+  } else {
+    local_last[num] = id;
+    local_next[num] = 0;
+  }
+  return id;
+}
+
+
+/*
+ * Resolves a local label term of a macro body, which was left unresolved while
+ * templating, at the point where the macro is instantiated.
+ * Returns the id of the label, as if the term was tokenized there.
+ */
+int  /* the id of the label */
+resolve_local_label(int term)
+{
+  int num = (-term - 1) / 3, kind = (-term - 1) % 3;
+  return local_label_id(num, LOCAL_SUFFIXES[kind]);
+}
+
+
+/*
+ * Sets (or unsets) templating mode, in which the bodies of macros are tokenized:
+ * local label terms aren't resolved, nor counted as definitions, as they're
+ * only resolved when the macro is instantiated.
+ */
+void
+set_templating(int on)
+{
+  templating = on;
+}
+
+
+/*
+ * Forgets the definitions of local labels, so that the references to them are
+ * resolved from the start of a file. Must be called before every pass over a file.
+ */
+void
+reset_local_labels()
+{
+  memset(local_last, 0, sizeof(local_last));
+  memset(local_next, 0, sizeof(local_next));
+  local_ids = 0;
+}
+
+
 /* 
  * Attempts to process the term as a register token,
  * on success updates tokval with the register id and returns 0.
@@ -261,6 +357,23 @@ is_labeldef(char *term)
 }
 
 
+/*
+ * A local label term consists of up to LOCAL_LABEL_DIGITS digits followed by suffix:
+ * ':' for a definition, 'b' or 'f' for a reference.
+ * Returns the number of the local label, or -1 if the term isn't such a term.
+ */
+static int  /* the number of the local label */
+parse_local_term(char *term, char suffix)
+{
+  int i, num = 0;
+  for(i=0; isdigit(term[i]); i++)
+    num = num * 10 + (term[i] - '0');
+  if(i == 0 || i > LOCAL_LABEL_DIGITS || term[i] != suffix || term[i+1] != '\0')
+    return -1;
+  return num;
+}
+
+
 /* 
  * A register consists of the char '$' followed by a number.
  *  e.g.: $0, $1, $2, ..., $31
@@ -319,6 +432,19 @@ tokenize_term(char *term)
 }
 
 
+/*
+ * Returns the token of a single term, regardless of the rest of its line,
+ * e.g. of an argument of a macro call.
+ */
+Token_t  /* the token that matches the term */
+tokenize_arg(char *term)
+{
+  Token_t tok = tokenize_term(strip_wspace(term));
+  tok.ind = -1;
+  return tok;
+}
+
+
 /* 
  * Returns the next token in line, which can be then
  * used to parse an assembly statement from that line.
@@ -331,7 +457,6 @@ tokenize_term(char *term)
 Token_t /* the next token in line */
 next_token(char *line)
 {
-  static char *next;
   static char *source;
   char *term;
   Token_t tok;
@@ -357,6 +482,48 @@ next_token(char *line)
 }
 
 
+/*
+ * Bulk alternative to calling next_token for each item of an array directive
+ * (.db, .dh, .dw): parses the rest of the line as comma-separated decimal immediates
+ * in a single scan, storing at most max of them in values.
+ * Returns the count of immediates, or -1 if the rest of the line isn't such an array
+ * whose immediates all fit in signed integers of the given bits.
+ * On failure nothing is consumed, so the caller can fall back to next_token,
+ * which pinpoints the erroneous item.
+ */
+int  /* count of immediates, -1 on failure */
+next_immed_array(int *values, int max, int bits)
+{
+  char *c = next;
+  int count = 0, digits, negative;
+  long immed;
+  if(expect != EXP_ARRAY)
+    return -1;
+  for(;;) {
+    while(isspace(*c)) c++;
+    negative = (*c == '-');
+    if(*c == '-' || *c == '+') c++;
+    /* at most 9 digits, so the immediate fits in an int */
+    for(immed = 0, digits = 0; isdigit(*c) && digits < 10; c++, digits++)
+      immed = immed * 10 + (*c - '0');
+    if(digits == 0 || digits == 10 || count == max)
+      return -1;
+    immed = negative ? -immed : immed;
+    if(!IN_BOUNDS(immed, bits))
+      return -1;
+    values[count++] = immed;
+    while(isspace(*c)) c++;
+    if(*c == '\0')
+      break;
+    if(*c++ != ',')
+      return -1;
+  }
+  next = c;
+  expect = 0;
+  return count;
+}
+
+
 /* 
  * Obtains and returns one term from the beginning of the line.
  * If none flags are set, the default delimiter is "\t \n" (tabs, spaces & newlines)
@@ -394,6 +561,10 @@ static char*  /* the next string */
 next_string(char *line)
 {
   int i;
+  if(templating && line[0] == PARAM_CHAR) {  /* a parameter of a macro, see "parser.c" */
+    line[strcspn(line, WSPACE_CHARS)] = '\0';
+    return line;
+  }
   if(line[0] != '"') {
     return NULL;
   }
@@ -439,7 +610,7 @@ strip_wspace(char *term)
     return NULL;
   }
   for(i=0; isspace(term[i]) ; i++);
-  for(j=strlen(term)-1; isspace(term[j]); j--);
+  for(j=strlen(term)-1; j >= 0 && isspace(term[j]); j--);
   term[++j] = '\0';
   return term + i;
 }
@@ -1,6 +1,10 @@
 /* ===== tokenizer.h ======================================
  * Header file for "tokenizer.c".
- * Exposes next_token function, see documentation of "tokenizer.c"
+ * Exposes next_token function, see documentation of "tokenizer.c",
+ * next_immed_array for parsing the items of array directives in bulk,
+ * and reset_local_labels, called at the start of every pass over a file.
+ * Also exposes the tokenization of macros (see "parser.c"): tokenize_arg for the
+ * arguments of a call, and set_templating & resolve_local_label for their bodies.
  */
 #ifndef TOKENIZER_H
 #define TOKENIZER_H
@@ -9,6 +13,11 @@
 #include "types.h"
 
 Token_t next_token(char *line);
+int next_immed_array(int *values, int max, int bits);
+void reset_local_labels();
+Token_t tokenize_arg(char *term);
+void set_templating(int on);
+int resolve_local_label(int term);
 
 
 #endif
@@ -17,6 +17,8 @@
  * Dir_t            - Generic directive parameters, implemented as a union.
  * struct AtypeDir  - Paramaters of array-type directives (.dh, .dw, .db).
  * struct StypeDir  - Paramaters of single(or string)-type directives (.asciz, .entry, .extern).
+ * struct NtypeDir  - Paramaters of numeric-type directives (.align, .space, .fill).
+ * struct BtypeDir  - Paramaters of binary-type directives (.incbin).
  *
  * ----- Generic statement & instruction ---
  * Instruction_t  - Generic instruction, implemented as a union.
@@ -63,16 +65,18 @@ struct RtypeOp {
 };
 
 struct ItypeOp {
-  char *label;    /* for branch ops */
+  int label;      /* for branch ops: id of the label (see "intern.c") */
   int16_t immed;  /* immed field as the launguage specs */
   uint8_t rt;     /* rt register id */
   uint8_t rs;     /* rs register id */
 };
 
 struct JtypeOp {
-  char *label;    /* assigned during tokenization: label name for operations that require a label */
-  int32_t addr;   /* assigned during parsing: address/id of the required label/register */
-  uint8_t reg;    /* 1 if jmp operation requires a register, else 0. */
+  int label;      /* assigned during tokenization: label id for operations that require a label */
+  int32_t addr;   /* assigned during parsing: address/id of the required label/register.
+                     for the li pseudo-operation: the value to load */
+  uint8_t reg;    /* 1 if jmp operation requires a register, else 0.
+                     for the li pseudo-operation: the register to load */
 };
 
 typedef union Op {
@@ -97,14 +101,28 @@ struct AtypeDir {
 
 /* Single (or String) type directives are .asciz, .entry or .extern */
 union StypeDir {
-  /* NOTE: Here *str and *label point to the same value, the union merely offers syntactic sugar. */
   char *str;      /* the string argument of a .asciz directive */
-  char *label;    /* the label argument of a .entry/.extern directive */
+  int label;      /* id of the label argument of a .entry/.extern directive */
+};
+
+/* Numeric type directives are .align, .space and .fill */
+struct NtypeDir {
+  uint8_t argc;   /* count of arguments of the directive */
+  long argv[3];   /* the arguments - .fill takes a count, a size and a value */
+};
+
+/* Binary type directives are .incbin */
+struct BtypeDir {
+  char *path;     /* path of the included file */
+  uint8_t argc;   /* count of numeric arguments: 0, or 2 for an offset and a length */
+  long argv[2];   /* the offset and length (in bytes) of the included part of the file */
 };
 
 typedef union Dir {
   struct AtypeDir Adir;
   union StypeDir Sdir;
+  struct NtypeDir Ndir;
+  struct BtypeDir Bdir;
 } Dir_t;
 
 enum DirId {
@@ -114,7 +132,11 @@ enum DirId {
   DIR_DH,
   DIR_ASCIZ,
   DIR_ENTRY,
-  DIR_EXTERN
+  DIR_EXTERN,
+  DIR_ALIGN,
+  DIR_INCBIN,
+  DIR_SPACE,
+  DIR_FILL
 };
 typedef struct DirInstruction {
   enum DirId dirid;   /* id of the directive as defined in consts.h */
@@ -138,9 +160,11 @@ enum StmType /* statement types */  {
 typedef struct Statement {
   enum StmType type;    /* type of the statement                            */
   int line_ind;         /* index of the statement's line                    */
-  char *label;          /* name of the label associated with the statement
+  int macro_line;       /* index of the macro line the statement was
+                           expanded from (see "parser.c"), 0 if none.       */
+  int label;            /* id of the label associated with the statement
                            (defined in the beginning of the line).
-                           NULL if irrelevant.                              */
+                           0 if irrelevant.                                 */
   Instruction_t inst;   /* instruction parameters                           */
 } Statement_t;
 
@@ -166,7 +190,7 @@ typedef union TokVal {
   char *str;      		/* corresponds to type TOK_STRING */
   long immed;		      /* corresponds to type TOK_IMMED */
   int reg;        		/* corresponds to type TOK_REG */
-  char *label;	    	/* corresponds to type TOK_LABEL or TOK_LABELDEF */
+  int label;	      	/* corresponds to type TOK_LABEL or TOK_LABELDEF */
 } TokVal_t;
 
 typedef struct Token {